@@ -0,0 +1,444 @@
+/*
+ * bm_bench.c		Throughput of the bm_build matchers
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Runs the runtime bm_find() and its x86-64 code from bm_jit(), glibc
+ *   memmem(), a memchr() + memcmp() baseline and, when built against a
+ *   header of bm_build -s -n NAME, the generated bm_find_NAME_scalar()
+ *   and bm_find_NAME() over one corpus:
+ *
+ *     cc -O2 -march=native -pthread -Iinclude -DBM_HDR='"p.h"' \
+ *        -DBM_NAME=p bm_bench.c lib/ts_bm.c lib/ts_bm_jit.c lib/ts_bm_batch.c
+ *
+ *   The corpus is a file (-c) or synthetic text or binary (-b) with the
+ *   pattern planted -d times per MiB. The adversarial one (-A) repeats the
+ *   pattern without its first byte: every window matches but for one byte,
+ *   the worst case of the kernels without a good suffix rule. Every
+ *   matcher must report the same number of matches, one CSV line is
+ *   printed per matcher:
+ *
+ *     pattern,len,icase,corpus,impl,bytes,matches,gbps,ns_match,cycles_byte
+ *
+ *   The best of -r rounds is kept. bm_bench.sh builds and runs it for a
+ *   set of patterns and compares the results with a previous run.
+ *
+ *   With -C len no corpus is searched: -N random patterns of len bytes
+ *   ("baa...a" ones with -A) are compiled with bm_init_batch(), by one
+ *   thread then by -j, the cost of loading a signature set:
+ *
+ *     len,kind,patterns,threads,kb,ms,us_per_kb
+ *
+ *   lib/ts_bm_batch.c is linked in, with -pthread.
+ *
+ *   Built with -DTS_BM_STATS and lib/ts_bm_stats.c, the counters of
+ *   bm_find() and of the generated matcher, all rounds summed up, are
+ *   printed to stderr at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "ts_bm.h"
+#include "ts_bm_jit.h"
+
+#ifdef BM_HDR
+#include BM_HDR
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define bench_cycles()	__rdtsc()
+#else
+#define bench_cycles()	0ULL
+#endif
+
+#define __BENCH_CAT(a, b)	a##b
+#define BENCH_CAT(a, b)		__BENCH_CAT(a, b)
+
+typedef uint8_t *(*bench_find_t)(const uint8_t *text, uint32_t len);
+
+static struct ts_bm *bench_bm;
+static struct ts_bm_jit *bench_jit;
+static uint8_t *pattern;
+static uint32_t patlen;
+static int ignorecase;
+
+static uint8_t *find_runtime(const uint8_t *text, uint32_t len)
+{
+	return bm_find(bench_bm, text, len);
+}
+
+static uint8_t *find_jit(const uint8_t *text, uint32_t len)
+{
+	return bm_jit_find(bench_jit, text, len);
+}
+
+static uint8_t *find_memmem(const uint8_t *text, uint32_t len)
+{
+	return memmem(text, len, pattern, patlen);
+}
+
+static uint8_t *find_memchr(const uint8_t *text, uint32_t len)
+{
+	const uint8_t *p = text, *end = text + len;
+
+	while (end - p >= patlen) {
+		p = memchr(p, pattern[0], end - p - patlen + 1);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p, pattern, patlen) == 0)
+			return (uint8_t *)p;
+		p++;
+	}
+	return NULL;
+}
+
+struct bench_impl
+{
+	const char *name;
+	bench_find_t find;
+	/* Also valid with -i */
+	int icase;
+};
+
+static const struct bench_impl bench_impl[] = {
+	{ "bm_find", find_runtime, 1 },
+	{ "jit", find_jit, 1 },
+	{ "memmem", find_memmem, 0 },
+	{ "memchr", find_memchr, 0 },
+#ifdef BM_NAME
+	{ "generated", BENCH_CAT(BENCH_CAT(bm_find_, BM_NAME), _scalar), 1 },
+	{ "generated_simd", BENCH_CAT(bm_find_, BM_NAME), 1 },
+#endif
+};
+
+/* Rough letter frequencies of English text */
+static const char text_alphabet[] =
+	"eeeeeeeeeeeetttttttttaaaaaaaaooooooooiiiiiiinnnnnnnsssssshhhhhh"
+	"rrrrrrddddlllluuuccmmwwffggyyppbbvk                  \n..,";
+
+static void corpus_plant(uint8_t *text, size_t size, double density)
+{
+	size_t nr, pos;
+	uint32_t j;
+
+	nr = size / (1 << 20) * density;
+	while (size >= patlen && nr--) {
+		pos = random() % (size - patlen + 1);
+		for (j = 0; j < patlen; j++) {
+			text[pos + j] = pattern[j];
+			if (ignorecase && (random() & 1))
+				text[pos + j] = toupper(text[pos + j]);
+		}
+	}
+}
+
+static uint8_t *corpus_synth(size_t size, int binary, double density)
+{
+	uint8_t *text = malloc(size);
+	size_t i;
+
+	if (text == NULL)
+		return NULL;
+	for (i = 0; i < size; i++) {
+		if (binary)
+			text[i] = random();
+		else
+			text[i] = text_alphabet[random() %
+						(sizeof(text_alphabet) - 1)];
+		if (ignorecase && (random() & 7) == 0)
+			text[i] = toupper(text[i]);
+	}
+
+	corpus_plant(text, size, density);
+	return text;
+}
+
+/* "aaa..." for "baa...a", the kernels without good suffix rule go n * m */
+static uint8_t *corpus_adversarial(size_t size, double density)
+{
+	uint8_t *text = malloc(size);
+	size_t i;
+
+	if (text == NULL)
+		return NULL;
+	for (i = 0; i < size; i++)
+		text[i] = patlen > 1 ? pattern[1 + i % (patlen - 1)] :
+				       pattern[0] ^ 1;
+	corpus_plant(text, size, density);
+	return text;
+}
+
+static uint8_t *corpus_file(const char *file, size_t *size)
+{
+	struct stat st;
+	uint8_t *text;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+		return NULL;
+	if (fstat(fileno(f), &st) < 0 || st.st_size > UINT32_MAX) {
+		fclose(f);
+		return NULL;
+	}
+	*size = st.st_size;
+	text = malloc(*size + 1);
+	if (text && fread(text, 1, *size, f) != *size) {
+		free(text);
+		text = NULL;
+	}
+	fclose(f);
+	return text;
+}
+
+/* Every match, restarting one byte after the previous one */
+static uint64_t bench_scan(bench_find_t find, const uint8_t *text,
+			   uint32_t len)
+{
+	uint64_t nr = 0;
+	uint32_t off = 0;
+	uint8_t *p;
+
+	while (off < len && (p = find(text + off, len - off)) != NULL) {
+		nr++;
+		off = p - text + 1;
+	}
+	return nr;
+}
+
+static uint64_t bench_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Best of rounds for the nr patterns of len bytes, 1 then threads threads */
+static int bench_compile(uint32_t len, uint32_t nr, int threads,
+			 int adversarial, int rounds)
+{
+	int flags = ignorecase ? TS_IGNORECASE : 0, t, r;
+	uint64_t ns, best_ns;
+	struct ts_bm_src *src;
+	uint8_t *pats, *buf, *p;
+	uint32_t i, j;
+	double kb;
+
+	pats = malloc((size_t)len * nr);
+	src = calloc(nr, sizeof(*src));
+	if (pats == NULL || src == NULL)
+		return -1;
+	for (i = 0, p = pats; i < nr; i++, p += len) {
+		for (j = 0; j < len; j++) {
+			if (adversarial)
+				p[j] = j ? 'a' : 'b';
+			else
+				p[j] = text_alphabet[random() %
+						     (sizeof(text_alphabet) - 1)];
+		}
+		src[i] = (struct ts_bm_src) {
+			.pattern = p, .len = len, .flags = flags,
+		};
+	}
+	buf = malloc(bm_batch_size(src, nr));
+	if (buf == NULL)
+		return -1;
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	kb = (double)len * nr / 1024;
+	for (t = 1; t <= threads; t = t == threads ? t + 1 : threads) {
+		best_ns = UINT64_MAX;
+		for (r = 0; r < rounds; r++) {
+			ns = bench_ns();
+			if (bm_init_batch(buf, src, nr, t))
+				return -1;
+			ns = bench_ns() - ns;
+			best_ns = ns < best_ns ? ns : best_ns;
+		}
+		printf("%u,%s,%u,%d,%.2f,%.3f,%.3f\n", len,
+		       adversarial ? "periodic" : "random", nr, t, kb,
+		       best_ns / 1e6, best_ns / 1e3 / kb);
+	}
+	free(buf);
+	free(src);
+	free(pats);
+	return 0;
+}
+
+static void bench_usage(void)
+{
+	fprintf(stderr, "Usage: bm_bench [-i] [-b] [-A] [-c corpus] [-S size] "
+		"[-d density] [-r rounds] \"Pattern String\"\n");
+	fprintf(stderr, "       bm_bench -C len [-i] [-A] [-N patterns] "
+		"[-j threads] [-r rounds]\n");
+	fprintf(stderr, "       -i  -- Ignore Case in Pattern String\n");
+	fprintf(stderr, "       -b  -- Binary synthetic corpus instead of "
+		"text\n");
+	fprintf(stderr, "       -A  -- Adversarial synthetic corpus, the "
+		"pattern less its first byte\n");
+	fprintf(stderr, "       -c  -- Corpus file instead of a synthetic "
+		"one\n");
+	fprintf(stderr, "       -S  -- Synthetic corpus size in MiB "
+		"(default 64)\n");
+	fprintf(stderr, "       -d  -- Matches planted per MiB (default 16)\n");
+	fprintf(stderr, "       -r  -- Rounds, the best one is kept "
+		"(default 5)\n");
+	fprintf(stderr, "       -C  -- Time the compilation of patterns of len "
+		"bytes instead\n");
+	fprintf(stderr, "       -N  -- Patterns compiled (default 1024)\n");
+	fprintf(stderr, "       -j  -- Threads compiling, one per CPU by "
+		"default\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *file = NULL, *corpus, *pat;
+	uint64_t expect = 0, nr = 0, ns, best_ns, cyc, best_cyc;
+	double density = 16;
+	size_t size = 64;
+	int opt, binary = 0, adversarial = 0, rounds = 5, i, r;
+	uint32_t compile_len = 0, compile_nr = 1024;
+	int threads = 0;
+	uint8_t *text;
+
+	while ((opt = getopt(argc, argv, "ibAc:S:d:r:C:N:j:")) != -1) {
+		switch (opt) {
+		case 'i':
+			ignorecase = 1;
+			break;
+		case 'b':
+			binary = 1;
+			break;
+		case 'A':
+			adversarial = 1;
+			break;
+		case 'c':
+			file = optarg;
+			break;
+		case 'S':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'd':
+			density = strtod(optarg, NULL);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'C':
+			compile_len = strtoul(optarg, NULL, 0);
+			break;
+		case 'N':
+			compile_nr = strtoul(optarg, NULL, 0);
+			break;
+		case 'j':
+			threads = atoi(optarg);
+			break;
+		default:
+			bench_usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (compile_len) {
+		if (optind != argc || rounds < 1 || compile_nr == 0) {
+			bench_usage();
+			exit(EXIT_FAILURE);
+		}
+		srandom(compile_len);
+		if (bench_compile(compile_len, compile_nr, threads,
+				  adversarial, rounds)) {
+			perror("bm_init_batch");
+			exit(EXIT_FAILURE);
+		}
+		return EXIT_SUCCESS;
+	}
+	if (optind != argc - 1 || rounds < 1 || size == 0 ||
+	    size >= 4096) {
+		bench_usage();
+		exit(EXIT_FAILURE);
+	}
+	pat = argv[optind];
+	pattern = calloc(1, strlen(pat) + 1);
+	patlen = bm_parse_pattern(pat, pattern,
+				  ignorecase ? TS_IGNORECASE : 0);
+	if (patlen == 0) {
+		fprintf(stderr, "Pattern Error.\n");
+		exit(EXIT_FAILURE);
+	}
+	bench_bm = bm_init(pattern, patlen, ignorecase ? TS_IGNORECASE : 0);
+	if (bench_bm == NULL) {
+		perror("bm_init");
+		exit(EXIT_FAILURE);
+	}
+	bench_jit = bm_jit(bench_bm);
+	if (bench_jit == NULL) {
+		perror("bm_jit");
+		exit(EXIT_FAILURE);
+	}
+
+	srandom(patlen);
+	if (file) {
+		text = corpus_file(file, &size);
+		corpus = strrchr(file, '/') ? strrchr(file, '/') + 1 : file;
+	} else {
+		size <<= 20;
+		if (adversarial) {
+			text = corpus_adversarial(size, density);
+			corpus = "synthetic-adversarial";
+		} else {
+			text = corpus_synth(size, binary, density);
+			corpus = binary ? "synthetic-binary" : "synthetic-text";
+		}
+	}
+	if (text == NULL) {
+		fprintf(stderr, "Corpus Error: %s\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+
+	for (i = 0; i < sizeof(bench_impl) / sizeof(bench_impl[0]); i++) {
+		if (ignorecase && !bench_impl[i].icase)
+			continue;
+		best_ns = best_cyc = UINT64_MAX;
+		for (r = 0; r < rounds; r++) {
+			ns = bench_ns();
+			cyc = bench_cycles();
+			nr = bench_scan(bench_impl[i].find, text, size);
+			cyc = bench_cycles() - cyc;
+			ns = bench_ns() - ns;
+			best_ns = ns < best_ns ? ns : best_ns;
+			best_cyc = cyc < best_cyc ? cyc : best_cyc;
+		}
+		if (i == 0)
+			expect = nr;
+		else if (nr != expect) {
+			fprintf(stderr, "%s: %llu matches, bm_find %llu\n",
+				bench_impl[i].name, (unsigned long long)nr,
+				(unsigned long long)expect);
+			exit(EXIT_FAILURE);
+		}
+		printf("%s,%u,%d,%s,%s,%zu,%llu,%.3f,%.2f,%.3f\n", pat, patlen,
+		       ignorecase, corpus, bench_impl[i].name, size,
+		       (unsigned long long)nr, (double)size / best_ns,
+		       nr ? (double)best_ns / nr : 0,
+		       (double)best_cyc / size);
+	}
+#ifdef TS_BM_STATS
+	bm_stats_dump(stderr);
+#endif
+	return EXIT_SUCCESS;
+}
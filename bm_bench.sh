@@ -0,0 +1,178 @@
+#!/bin/sh
+#
+# bm_bench.sh		Benchmark the bm_build matchers over a set of patterns
+#
+# Builds bm_build, then for every pattern a header with bm_build -s and a
+# bm_bench against it, and prints the CSV lines of all the runs. With -B
+# the results are compared with the CSV of a previous run: base_gbps,
+# delta_pct and status columns are added and the exit status is 1 when a
+# matcher lost more than -T percent of its throughput.
+#
+# Patterns are read one per line (-p), same syntax as bm_build -f: a line
+# starting with "-i " ignores case, "#" is a comment. Patterns with \x
+# escapes run over the binary synthetic corpus. The default set has text
+# and binary patterns of 1 to 256 bytes, with and without -i.
+#
+# -A runs every pattern over the adversarial corpus of bm_bench -A too, and
+# adds "baa...a" patterns to the default set, so that the cost of crafted
+# and random text are side by side. -L builds the headers with bm_build -L.
+#
+# -C only times the compilation of pattern sets with bm_init_batch(), by
+# one thread and by one per CPU, for patterns of 16 bytes to 16 KB (periodic
+# "baa...a" ones too with -A), and prints bm_bench -C lines instead.
+#
+
+CC=${CC:-cc}
+CFLAGS=${CFLAGS:-"-O2 -march=native"}
+SRC=$(cd "$(dirname "$0")" && pwd)
+
+usage()
+{
+	echo "Usage: bm_bench.sh [-p patterns] [-c corpus] [-S size] [-d density]" >&2
+	echo "                   [-r rounds] [-a algo] [-A] [-L] [-B baseline.csv]" >&2
+	echo "                   [-T pct] [-C]" >&2
+	exit 1
+}
+
+patterns= corpus= size=64 density=16 rounds=5 algo=auto baseline= thresh=5
+adversarial= linear= compile=
+while getopts "p:c:S:d:r:a:ALB:T:C" opt; do
+	case $opt in
+	p) patterns=$OPTARG ;;
+	c) corpus=$OPTARG ;;
+	S) size=$OPTARG ;;
+	d) density=$OPTARG ;;
+	r) rounds=$OPTARG ;;
+	a) algo=$OPTARG ;;
+	A) adversarial=1 ;;
+	L) linear=-L ;;
+	B) baseline=$OPTARG ;;
+	T) thresh=$OPTARG ;;
+	C) compile=1 ;;
+	*) usage ;;
+	esac
+done
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+default_patterns()
+{
+	text="the quick brown fox jumps over the lazy dog, Host: User-Agent: "
+	while [ ${#text} -lt 256 ]; do
+		text="$text$text"
+	done
+	for len in 1 2 4 8 16 32 64 128 256; do
+		pat=$(printf '%s' "$text" | cut -c1-$len)
+		echo "$pat"
+		echo "-i $pat"
+		awk -v len=$len 'BEGIN {
+			srand(len);
+			for (i = 0; i < len; i++)
+				printf("\\x%02x", int(rand() * 256));
+			printf("\n");
+		}'
+	done
+	[ -z "$adversarial" ] && return
+	for len in 8 32 128; do
+		awk -v len=$len 'BEGIN {
+			printf("b");
+			for (i = 1; i < len; i++)
+				printf("a");
+			printf("\n");
+		}'
+	done
+}
+
+if [ -n "$patterns" ]; then
+	cat "$patterns"
+else
+	default_patterns
+fi > "$dir/patterns"
+
+$CC $CFLAGS -I"$SRC/include" -c -o "$dir/ts_bm.o" "$SRC/lib/ts_bm.c" &&
+$CC $CFLAGS -I"$SRC/include" -c -o "$dir/ts_bm_jit.o" \
+	"$SRC/lib/ts_bm_jit.c" &&
+$CC $CFLAGS -pthread -I"$SRC/include" -c -o "$dir/ts_bm_batch.o" \
+	"$SRC/lib/ts_bm_batch.c" &&
+$CC $CFLAGS -I"$SRC/include" -o "$dir/bm_build" "$SRC/bm_build.c" \
+	"$dir/ts_bm.o" || exit 1
+
+if [ -n "$compile" ]; then
+	$CC $CFLAGS -pthread -I"$SRC/include" -o "$dir/bench" \
+		"$SRC/bm_bench.c" "$dir/ts_bm.o" "$dir/ts_bm_jit.o" \
+		"$dir/ts_bm_batch.o" || exit 1
+	echo "len,kind,patterns,threads,kb,ms,us_per_kb"
+	for len in 16 64 256 1024 4096 16384; do
+		"$dir/bench" -C $len -r "$rounds" || exit 1
+		[ -n "$adversarial" ] && { "$dir/bench" -C $len -A \
+			-r "$rounds" || exit 1; }
+	done
+	exit 0
+fi
+
+n=0
+echo "pattern,len,icase,corpus,impl,bytes,matches,gbps,ns_match,cycles_byte" \
+	> "$dir/out.csv"
+while IFS= read -r line; do
+	case $line in
+	""|\#*) continue ;;
+	"-i "*) icase=-i; pat=${line#-i } ;;
+	*) icase=; pat=$line ;;
+	esac
+	# Same pattern, CSV safe
+	pat=$(printf '%s' "$pat" | sed 's/,/\\x2c/g; s/"/\\x22/g')
+	n=$((n + 1))
+
+	kind=
+	case $pat in
+	*\\x*) [ -z "$corpus" ] && kind=-b ;;
+	esac
+	"$dir/bm_build" $icase $linear -s -a "$algo" -n p$n "$pat" \
+		> "$dir/p$n.h" \
+		2> /dev/null || { echo "bm_build failed: $line" >&2; exit 1; }
+	$CC $CFLAGS -pthread -I"$SRC/include" -DBM_HDR="\"$dir/p$n.h\"" \
+		-DBM_NAME=p$n -o "$dir/bench" "$SRC/bm_bench.c" \
+		"$dir/ts_bm.o" "$dir/ts_bm_jit.o" "$dir/ts_bm_batch.o" || exit 1
+	runs=${kind:-text}
+	[ -n "$adversarial" ] && [ -z "$corpus" ] && runs="$runs -A"
+	for run in $runs; do
+		[ "$run" = text ] && run=
+		"$dir/bench" $icase $run ${corpus:+-c "$corpus"} \
+			-S "$size" -d "$density" -r "$rounds" "$pat" \
+			>> "$dir/out.csv" 2> "$dir/bench.err" ||
+			{ cat "$dir/bench.err" >&2; exit 1; }
+	done
+done < "$dir/patterns"
+
+if [ -z "$baseline" ]; then
+	cat "$dir/out.csv"
+	exit 0
+fi
+
+# Join on pattern, icase, corpus and matcher
+awk -F, -v thresh="$thresh" '
+NR == FNR {
+	if (FNR > 1)
+		base[$1 FS $3 FS $4 FS $5] = $8;
+	next;
+}
+FNR == 1 {
+	print $0 ",base_gbps,delta_pct,status";
+	next;
+}
+{
+	key = $1 FS $3 FS $4 FS $5;
+	if (!(key in base) || base[key] == 0) {
+		print $0 ",,,new";
+		next;
+	}
+	delta = ($8 - base[key]) * 100 / base[key];
+	status = delta < -thresh ? "regression" : "ok";
+	if (status == "regression")
+		bad = 1;
+	printf("%s,%s,%.1f,%s\n", $0, base[key], delta, status);
+}
+END {
+	exit bad;
+}' "$baseline" "$dir/out.csv"
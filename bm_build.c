@@ -1,5 +1,5 @@
 /*
- * lib/ts_bm.c		Boyer-Moore text search implementation
+ * bm_build.c		Boyer-Moore matcher generator
  *
  *		This program is free software; you can redistribute it and/or
  *		modify it under the terms of the GNU General Public License
@@ -10,29 +10,35 @@
  *
  * ==========================================================================
  *
- *   Implements Boyer-Moore string matching algorithm:
+ *   Generates a C header with a Boyer-Moore matcher specialized for one
+ *   pattern, the shift tables and the pattern being constants. The runtime
+ *   matcher is lib/ts_bm.c, see there for the algorithm.
  *
- *   [1] A Fast String Searching Algorithm, R.S. Boyer and Moore.
- *       Communications of the Association for Computing Machinery,
- *       20(10), 1977, pp. 762-772.
- *       http://www.cs.utexas.edu/users/moore/publications/fstrpos.pdf
+ *   As bm_find_stream(), the generated bm_find_stream_<pattern>() keeps the
+ *   last patlen - 1 bytes of the previous fragment, so BM also finds the
+ *   matchings spread over them.
  *
- *   [2] Handbook of Exact String Matching Algorithms, Thierry Lecroq, 2004
- *       http://www-igm.univ-mlv.fr/~lecroq/string/string.pdf
+ *   Instead of BM, the generated bm_find_<pattern>() may use Horspool,
+ *   Sunday (Quick Search), Raita, Two-Way or the q-gram shifts of
+ *   bm_find(), see the Handbook of Exact String Matching Algorithms
+ *   (T. Lecroq) for all of them. -a picks the kernel, by default it is
+ *   chosen from the length, period and distinct bytes of the pattern.
  *
- *   Note: Since Boyer-Moore (BM) performs searches for matchings from right
- *   to left, it's still possible that a matching could be spread over
- *   multiple blocks, in that case this algorithm won't find any coincidence.
+ *   With --profile a sample of the traffic gives the byte frequencies, the
+ *   Horspool, Sunday and q-gram kernels check the rarest bytes of the
+ *   pattern first, Raita-style, and the SIMD filter compares the two
+ *   rarest instead of the first and last ones. BM and Two-Way keep their
+ *   own order.
  *
- *   If you're willing to ensure that such thing won't ever happen, use the
- *   Knuth-Pratt-Morris (KMP) implementation instead. In conclusion, choose
- *   the proper string search algorithm depending on your setting.
+ *   Horspool, Sunday and Raita have no good suffix rule and take up to
+ *   n * m compares on crafted text ("aaa..." for "baa...a"). -L keeps to
+ *   BM, Two-Way and q-grams, whose verifications are bounded, and bounds
+ *   the verifications of the SIMD filter: past twice the text scanned,
+ *   the rest of it goes to the scalar kernel.
  *
- *   Say you're using the textsearch infrastructure for filtering, NIDS or
- *   any similar security focused purpose, then go KMP. Otherwise, if you
- *   really care about performance, say you're classifying packets to apply
- *   Quality of Service (QoS) policies, and you don't mind about possible
- *   matchings spread over multiple fragments, then go BM.
+ *   The kernels carry the TS_BM_STAT*() hooks of ts_bm.h: compiled with
+ *   -DTS_BM_STATS they count their work as bm_find() does, under the
+ *   symbol name of the pattern, else the hooks are empty.
  */
 
 #include <stdio.h>
@@ -40,97 +46,77 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "common.h"
+#include "ts_bm.h"
 
 /* Alphabet size, use ASCII */
-#define ASIZE 256
-
-#define max_t(type, x, y) ({			\
-	type __max1 = (x);			\
-	type __max2 = (y);			\
-	__max1 > __max2 ? __max1 : __max2; })
-
-static inline uint8_t __hextou8(char *str, int *err)
-{
-	uint8_t ret = 0;
-	*err = 0;
-	switch (*str) {
-	case '0' ... '9':
-		ret = (*str - '0') << 4;
-		break;
-	case 'A' ... 'F':
-		ret = (*str - 'A' + 10) << 4;
-		break;
-	case 'a' ... 'f':
-		ret = (*str - 'a' + 10) << 4;
-		break;
-	default:
-		*err = 1;
-		return 0;
-	}
-	++str;
-	switch (*str) {
-	case '0' ... '9':
-		ret |= (*str - '0');
-		break;
-	case 'A' ... 'F':
-		ret |= (*str - 'A' + 10);
-		break;
-	case 'a' ... 'f':
-		ret |= (*str - 'a' + 10);
-		break;
-	default:
-		*err = 1;
-		return 0;
-	}
-	return ret;
-}
-
-struct ts_bm
-{
-	uint8_t *pattern;
-	uint32_t patlen;
-	uint32_t bad_shift[ASIZE];
-	uint32_t good_shift[0];
-};
+#define ASIZE TS_BM_ASIZE
 
 static char *pattern;
 static uint32_t patlen;
 static char *app_name;
 static int ignorecase;
+static int simd;
+/* Symbol suffix of the generated code, the pattern itself by default */
+static char *sym;
+static int extended;
+/* Only kernels with a worst case linear in the text */
+static int linear;
 
-static inline uint8_t *bm_find(struct ts_bm *bm, const uint8_t *text,
-			       uint32_t text_len)
-{
-	unsigned int i;
-	int shift = bm->patlen - 1, bs;
-
-	while (shift < text_len) {
-		for (i = 0; i < bm->patlen; i++)
-			if ((ignorecase ?
-			     tolower(text[shift - i]) : text[shift - i])
-			    != bm->pattern[bm->patlen - 1 - i])
-				goto next;
+/*
+ * --profile: pattern positions checked first, the rarest bytes in the
+ * corpus, distinct. The SIMD filter takes the first two.
+ */
+#define PROFILE_CHECKS	3
+static int prof_pos[PROFILE_CHECKS];
+static int prof_nr;
 
-		/* London calling... */
-		return (uint8_t *)text + (shift- (bm->patlen - 1));
+/* get_bs_/get_gs_ form, switch() beyond SHIFT_SWITCH_MAX cases is a table */
+enum { SHIFT_AUTO, SHIFT_SWITCH, SHIFT_TABLE };
+#define SHIFT_SWITCH_MAX	4
+static int shift_mode;
 
-next:
-		bs = bm->bad_shift[text[shift - i]];
+/* Search kernel behind bm_find_<pattern>() */
+enum { ALGO_AUTO, ALGO_BM, ALGO_HORSPOOL, ALGO_SUNDAY, ALGO_RAITA,
+	ALGO_TWOWAY, ALGO_HASHQ, ALGO_NR };
+static const char *algo_name[ALGO_NR] = {
+	[ALGO_AUTO] = "auto",
+	[ALGO_BM] = "bm",
+	[ALGO_HORSPOOL] = "horspool",
+	[ALGO_SUNDAY] = "sunday",
+	[ALGO_RAITA] = "raita",
+	[ALGO_TWOWAY] = "twoway",
+	[ALGO_HASHQ] = "hashq",
+};
+static int algo;
 
-		/* Now jumping to... */
-		shift = max_t(int, shift - i + bs, shift + bm->good_shift[i]);
-	}
+/* Shared by all the -i headers of a program */
+static void build_fold(void)
+{
+	int i;
 
-	return NULL;
+	printf("#ifndef __BM_FOLD\n");
+	printf("#define __BM_FOLD\n");
+	printf("static const uint8_t bm_fold[256] = {");
+	for (i = 0; i < ASIZE; i++)
+		printf("%s0x%02x,", (i % 16) == 0 ? "\n\t" : " ",
+		       ts_bm_fold[i]);
+	printf("\n};\n");
+	printf("#endif\n\n");
 }
 
 #define PATTERN_STR ({ \
 	int i; \
-	for (i = 0; i < patlen; i++) \
+	if (sym) \
+		printf("%s", sym); \
+	else for (i = 0; i < patlen; i++) \
 		if (isalnum(pattern[i]) || pattern[i] == '_') \
 			printf("%c", pattern[i]); \
 		else \
-			printf("%02x", pattern[i]); })
+			printf("%02x", (uint8_t)pattern[i]); })
 
 static void build_file_pre(void)
 {
@@ -144,266 +130,1723 @@ static void build_file_pre(void)
 	printf("#include <stdlib.h>\n");
 	printf("#include <stdint.h>\n");
 	printf("#include <string.h>\n\n");
+	/* Counters of ts_bm.h with -DTS_BM_STATS, else empty hooks */
+	printf("#ifdef TS_BM_STATS\n");
+	printf("#include \"ts_bm.h\"\n");
+	printf("static const char bm_stats_name_");
+	PATTERN_STR;
+	printf("[] = \"");
+	PATTERN_STR;
+	printf("\";\n");
+	printf("#elif !defined(TS_BM_STAT)\n");
+	printf("#define TS_BM_STAT(st, f, v)\t\t((void)0)\n");
+	printf("#define TS_BM_STAT_SHIFT(st, v)\t\t((void)0)\n");
+	printf("#define TS_BM_STAT_RET(st, start, end, p)\t(p)\n");
+	printf("#endif\n\n");
+	if (ignorecase)
+		build_fold();
 }
 
-static void build_file_post(void)
+/* Counters of the pattern in a kernel, start is its first text offset */
+static void build_stats_get(const char *start)
 {
-	printf("static inline uint8_t *bm_find_");
+	printf("#ifdef TS_BM_STATS\n");
+	printf("\tstruct ts_bm_stats *st = bm_stats_get(bm_stats_name_");
 	PATTERN_STR;
-	printf("(const uint8_t *text, uint32_t len)\n");
-	printf("{\n");
-	printf("\tint i, shift = %d - 1, bs, gs;\n", patlen);
-	printf("\tconst uint8_t pattern[] = {");
+	printf(",\n\t\tbm_stats_name_");
+	PATTERN_STR;
+	printf(", %d);\n", patlen);
+	if (start)
+		printf("\tint start = %s;\n", start);
+	printf("#endif\n");
+}
+
+/* Text byte as compared against the pattern, fmt gives its index */
+static void build_text(const char *fmt, ...)
+{
+	char idx[64];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(idx, sizeof(idx), fmt, ap);
+	va_end(ap);
+	printf(ignorecase ? "bm_fold[text[%s]]" : "text[%s]", idx);
+}
+
+static void build_pattern(void)
+{
 	int i;
+
+	printf("\tconst uint8_t pattern[] = {");
 	for (i = 0; i < patlen; i++)
-		printf(" 0x%X,", pattern[i]);
+		printf(" 0x%X,", (uint8_t)pattern[i]);
 	printf("};\n");
+}
+
+static void build_find_proto(void)
+{
+	printf("static inline uint8_t *bm_find_");
+	PATTERN_STR;
+	printf("%s(const uint8_t *text, uint32_t len)\n", simd ? "_scalar" : "");
+}
+
+/* Boyer-Moore, resumable from any shift: also the base of find all */
+static void build_file_post(void)
+{
+	printf("static inline uint8_t *bm_scan_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len, int shift,\n");
+	printf("\t\tint known)\n");
+	printf("{\n");
+	char start[32];
+
+	snprintf(start, sizeof(start), "shift - %d + 1", patlen);
+	printf("\tint i, bs, gs, n = %d - known;\n", patlen);
+	build_pattern();
+	build_stats_get(start);
 	printf("\twhile (shift < len) {\n");
-	printf("\t\tfor (i = 0; i < %d; i++)\n", patlen);
-	if (ignorecase)
-		printf("\t\t\tif (tolower(text[shift - i]) != pattern[%d - 1 - i])\n",
-		       patlen);
-	else
-		printf("\t\t\tif (text[shift - i] != pattern[%d - 1 - i])\n",
-		       patlen);
+	printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+	printf("\t\tfor (i = 0; i < n; i++)\n");
+	printf("\t\t\tif (");
+	build_text("shift - i");
+	printf(" != pattern[%d - 1 - i])\n", patlen);
 	printf("\t\t\t\tgoto next;\n");
-	printf("\t\treturn (uint8_t *)text + shift - %d + 1;\n", patlen);
+	printf("\t\tTS_BM_STAT(st, compares, n);\n");
+	printf("\t\tTS_BM_STAT(st, verified, 1);\n");
+	printf("\t\treturn TS_BM_STAT_RET(st, start, shift + 1,\n");
+	printf("\t\t\t(uint8_t *)text + shift - %d + 1);\n", patlen);
 	printf("next:\n");
+	printf("\t\tTS_BM_STAT(st, compares, i + 1);\n");
+	printf("\t\tTS_BM_STAT(st, verified, i > 0);\n");
+	printf("\t\tn = %d;\n", patlen);
 	printf("\t\tbs = shift - i + get_bs_");
 	PATTERN_STR;
 	printf("(text[shift - i]);\n");
 	printf("\t\tgs = shift + get_gs_");
 	PATTERN_STR;
 	printf("(i);\n");
+	printf("\t\tTS_BM_STAT_SHIFT(st, (bs > gs ? bs : gs) - shift);\n");
 	printf("\t\tshift = bs > gs ? bs : gs;\n");
 	printf("\t}\n");
-	printf("\treturn NULL;\n");
+	printf("\treturn TS_BM_STAT_RET(st, start, len, NULL);\n");
 	printf("}\n");
-	printf("#endif\n");
 }
 
-static void build_gs_pre(void)
+/* Text byte at k in the window ending at shift, or starting at pos */
+static void build_window_byte(int pos, int k)
+{
+	if (pos)
+		k ? build_text("pos + %d", k) : build_text("pos");
+	else
+		k == patlen - 1 ? build_text("shift") :
+			build_text("shift - %d", patlen - 1 - k);
+}
+
+/* Early checks of the window, chk[] positions in order */
+static void build_checks(int pos, const int *chk, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		if (i)
+			printf(" &&\n\t\t    ");
+		build_window_byte(pos, chk[i]);
+		printf(" == 0x%X", (uint8_t)pattern[chk[i]]);
+	}
+}
+
+/*
+ * Horspool: the last byte of the window only picks the shift. Raita checks
+ * the last, first and middle bytes before the others, the profile its
+ * rarest ones.
+ */
+static void build_horspool(int raita)
 {
-	printf("static inline int get_gs_");
+	int m = patlen, chk[PROFILE_CHECKS], n = 0, lo = raita, hi = m - 1, i;
+
+	if (prof_nr) {
+		/* The shift byte is loaded anyway, then the rarest ones */
+		chk[n++] = m - 1;
+		for (i = 0; i < prof_nr && n < PROFILE_CHECKS; i++)
+			if (prof_pos[i] != m - 1)
+				chk[n++] = prof_pos[i];
+		lo = 0;
+		hi = m;
+	} else {
+		chk[n++] = m - 1;
+		if (raita) {
+			chk[n++] = 0;
+			chk[n++] = m / 2;
+		}
+	}
+
+	build_find_proto();
+	printf("{\n");
+	build_pattern();
+	printf("\tuint32_t shift = %d - 1;\n", m);
+	printf("\tint i;\n");
+	build_stats_get(NULL);
+	printf("\n");
+	printf("\twhile (shift < len) {\n");
+	/* A failed early check counts as one compare */
+	printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+	printf("\t\tTS_BM_STAT(st, compares, 1);\n");
+	printf("\t\tif (");
+	build_checks(0, chk, n);
+	printf(") {\n");
+	printf("\t\t\tTS_BM_STAT(st, verified, 1);\n");
+	printf("\t\t\tfor (i = %d; i < %d; i++)\n", lo, hi);
+	printf("\t\t\t\tif (");
+	build_text("shift - %d + i", m - 1);
+	printf(" != pattern[i])\n");
+	printf("\t\t\t\t\tbreak;\n");
+	/* The checks passed, and the loop up to its mismatch */
+	if (n - 1 - lo)
+		printf("\t\t\tTS_BM_STAT(st, compares, i + %d + (i < %d));\n",
+		       n - 1 - lo, hi);
+	else
+		printf("\t\t\tTS_BM_STAT(st, compares, i + (i < %d));\n", hi);
+	printf("\t\t\tif (i >= %d)\n", hi);
+	printf("\t\t\t\treturn TS_BM_STAT_RET(st, 0, shift + 1,\n");
+	printf("\t\t\t\t\t(uint8_t *)text + shift - %d);\n", m - 1);
+	printf("\t\t}\n");
+	printf("\t\tTS_BM_STAT_SHIFT(st, get_bs_");
 	PATTERN_STR;
-	printf("(int i)\n");
+	printf("(text[shift]));\n");
+	printf("\t\tshift += get_bs_");
+	PATTERN_STR;
+	printf("(text[shift]);\n");
+	printf("\t}\n");
+	printf("\treturn TS_BM_STAT_RET(st, 0, len, NULL);\n");
+	printf("}\n");
+}
+
+/*
+ * Compare of the whole window, starting at text[start + 0], after the
+ * checks of the profile if any. Returns ret on a match.
+ */
+static void build_verify(int pos, const char *start, const char *ret,
+			 const char *end)
+{
+	const char *tab = prof_nr ? "\t" : "";
+
+	if (prof_nr) {
+		printf("\t\tTS_BM_STAT(st, compares, 1);\n");
+		printf("\t\tif (");
+		build_checks(pos, prof_pos, prof_nr);
+		printf(") {\n");
+	}
+	printf("%s\t\tTS_BM_STAT(st, verified, 1);\n", tab);
+	printf("%s\t\tfor (i = 0; i < %d; i++)\n", tab, patlen);
+	printf("%s\t\t\tif (", tab);
+	build_text("%s", start);
+	printf(" != pattern[i])\n");
+	printf("%s\t\t\t\tbreak;\n", tab);
+	if (prof_nr > 1)
+		printf("%s\t\tTS_BM_STAT(st, compares, i + %d + (i < %d));\n",
+		       tab, prof_nr - 1, patlen);
+	else
+		printf("%s\t\tTS_BM_STAT(st, compares, i + (i < %d));\n",
+		       tab, patlen);
+	printf("%s\t\tif (i == %d)\n", tab, patlen);
+	printf("%s\t\t\treturn TS_BM_STAT_RET(st, 0, %s, %s);\n", tab, end,
+	       ret);
+	if (prof_nr)
+		printf("\t\t}\n");
+}
+
+/* Sunday (Quick Search): shift on the byte right after the window */
+static void build_sunday(void)
+{
+	int m = patlen;
+	char end[32];
+
+	snprintf(end, sizeof(end), "pos + %d", m);
+	build_find_proto();
 	printf("{\n");
-	printf("\tswitch (i) {\n");
-	printf("\tdefault: return %d;\n", patlen);
-	printf("\tcase 0: return 1;\n");
+	build_pattern();
+	printf("\tuint32_t pos = 0;\n");
+	printf("\tint i;\n");
+	build_stats_get(NULL);
+	printf("\n");
+	printf("\twhile (pos + %d <= len) {\n", m);
+	printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+	build_verify(1, "pos + i", "(uint8_t *)text + pos", end);
+	printf("\t\tif (pos + %d == len)\n", m);
+	printf("\t\t\tbreak;\n");
+	printf("\t\tTS_BM_STAT_SHIFT(st, get_qs_");
+	PATTERN_STR;
+	printf("(text[pos + %d]));\n", m);
+	printf("\t\tpos += get_qs_");
+	PATTERN_STR;
+	printf("(text[pos + %d]);\n", m);
+	printf("\t}\n");
+	printf("\treturn TS_BM_STAT_RET(st, 0, len, NULL);\n");
+	printf("}\n");
 }
 
-static void build_gs_post(void)
+/* Maximal suffix of the pattern for the byte order (rev) or its reverse */
+static int max_suffix(const uint8_t *x, int m, int rev, int *p)
 {
+	int ms = -1, j = 0, k = 1, a, b;
+
+	*p = 1;
+	while (j + k < m) {
+		a = x[j + k];
+		b = x[ms + k];
+		if (rev) {
+			a = x[ms + k];
+			b = x[j + k];
+		}
+		if (a < b) {
+			j += k;
+			k = 1;
+			*p = j - ms;
+		} else if (a == b) {
+			if (k != *p) {
+				++k;
+			} else {
+				j += *p;
+				k = 1;
+			}
+		} else {
+			ms = j;
+			j = ms + 1;
+			k = *p = 1;
+		}
+	}
+	return ms;
+}
+
+/*
+ * Two-Way (Crochemore-Perrin): linear in the worst case in constant
+ * space, the critical factorization is computed at build time.
+ */
+static void build_twoway(void)
+{
+	const uint8_t *x = (const uint8_t *)pattern;
+	int m = patlen, ell, per, i, j, p, q;
+
+	i = max_suffix(x, m, 0, &p);
+	j = max_suffix(x, m, 1, &q);
+	if (i > j) {
+		ell = i;
+		per = p;
+	} else {
+		ell = j;
+		per = q;
+	}
+
+	build_find_proto();
+	printf("{\n");
+	build_pattern();
+	printf("\tuint32_t j = 0;\n");
+	if (memcmp(x, x + per, ell + 1) == 0) {
+		printf("\tint i, memory = -1;\n");
+		build_stats_get(NULL);
+		printf("\n");
+		printf("\twhile (j + %d <= len) {\n", m);
+		printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+		printf("\t\ti = (%d > memory ? %d : memory) + 1;\n", ell, ell);
+		printf("\t\twhile (i < %d && ", m);
+		build_text("j + i");
+		printf(" == pattern[i])\n");
+		printf("\t\t\ti++;\n");
+		printf("\t\tTS_BM_STAT(st, compares, i - (%d > memory ? %d : "
+		       "memory) - 1 + (i < %d));\n", ell, ell, m);
+		printf("\t\tif (i >= %d) {\n", m);
+		printf("\t\t\tTS_BM_STAT(st, verified, 1);\n");
+		printf("\t\t\ti = %d;\n", ell);
+		printf("\t\t\twhile (i > memory && ");
+		build_text("j + i");
+		printf(" == pattern[i])\n");
+		printf("\t\t\t\ti--;\n");
+		printf("\t\t\tTS_BM_STAT(st, compares, %d - i + (i > memory));\n",
+		       ell);
+		printf("\t\t\tif (i <= memory)\n");
+		printf("\t\t\t\treturn TS_BM_STAT_RET(st, 0, j + %d,\n", m);
+		printf("\t\t\t\t\t(uint8_t *)text + j);\n");
+		printf("\t\t\tTS_BM_STAT_SHIFT(st, %d);\n", per);
+		printf("\t\t\tj += %d;\n", per);
+		printf("\t\t\tmemory = %d;\n", m - per - 1);
+		printf("\t\t} else {\n");
+		printf("\t\t\tTS_BM_STAT_SHIFT(st, i - %d);\n", ell);
+		printf("\t\t\tj += i - %d;\n", ell);
+		printf("\t\t\tmemory = -1;\n");
+		printf("\t\t}\n");
+	} else {
+		per = (ell + 1 > m - ell - 1 ? ell + 1 : m - ell - 1) + 1;
+		printf("\tint i;\n");
+		build_stats_get(NULL);
+		printf("\n");
+		printf("\twhile (j + %d <= len) {\n", m);
+		printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+		printf("\t\ti = %d;\n", ell + 1);
+		printf("\t\twhile (i < %d && ", m);
+		build_text("j + i");
+		printf(" == pattern[i])\n");
+		printf("\t\t\ti++;\n");
+		printf("\t\tTS_BM_STAT(st, compares, i - %d + (i < %d));\n",
+		       ell + 1, m);
+		printf("\t\tif (i >= %d) {\n", m);
+		printf("\t\t\tTS_BM_STAT(st, verified, 1);\n");
+		printf("\t\t\ti = %d;\n", ell);
+		printf("\t\t\twhile (i >= 0 && ");
+		build_text("j + i");
+		printf(" == pattern[i])\n");
+		printf("\t\t\t\ti--;\n");
+		printf("\t\t\tTS_BM_STAT(st, compares, %d - i + (i >= 0));\n",
+		       ell);
+		printf("\t\t\tif (i < 0)\n");
+		printf("\t\t\t\treturn TS_BM_STAT_RET(st, 0, j + %d,\n", m);
+		printf("\t\t\t\t\t(uint8_t *)text + j);\n");
+		printf("\t\t\tTS_BM_STAT_SHIFT(st, %d);\n", per);
+		printf("\t\t\tj += %d;\n", per);
+		printf("\t\t} else {\n");
+		printf("\t\t\tTS_BM_STAT_SHIFT(st, i - %d);\n", ell);
+		printf("\t\t\tj += i - %d;\n", ell);
+		printf("\t\t}\n");
+	}
 	printf("\t}\n");
+	printf("\treturn TS_BM_STAT_RET(st, 0, len, NULL);\n");
+	printf("}\n");
+}
+
+/*
+ * Pick the kernel from the pattern statistics:
+ *  - periodic patterns keep a linear worst case with Two-Way,
+ *  - long ones shift on q-grams as bm_find(),
+ *  - few distinct bytes make short bad character shifts, the good suffix
+ *    rule of BM pays off,
+ *  - the m + 1 shift of Sunday counts most for very short patterns,
+ *  - Horspool for short keywords, Raita when their first, middle and last
+ *    bytes differ, so the early checks reject most windows,
+ *  - BM for the long ones.
+ */
+static int algo_auto(struct ts_bm *bm)
+{
+	const uint8_t *pat = bm_pattern(bm);
+	uint8_t seen[ASIZE] = { 0 };
+	uint32_t m = bm->patlen, i, distinct = 0;
+
+	for (i = 0; i < m; i++) {
+		distinct += !seen[pat[i]];
+		seen[pat[i]] = 1;
+	}
+	if (m > 8 && bm->match_shift <= m / 2)
+		return ALGO_TWOWAY;
+	if (bm_qgram(m))
+		return ALGO_HASHQ;
+	if (m > 4 && distinct < m / 2)
+		return ALGO_BM;
+	if (m <= 4)
+		return ALGO_SUNDAY;
+	if (m <= 16) {
+		if (pat[0] != pat[m - 1] && pat[0] != pat[m / 2] &&
+		    pat[m / 2] != pat[m - 1])
+			return ALGO_RAITA;
+		return ALGO_HORSPOOL;
+	}
+	return ALGO_BM;
+}
+
+/* Same as bm_find_all(), bm_count() and bm_find_offs() */
+static void build_find_all(struct ts_bm *bm)
+{
+	printf("\n#ifndef BM_OVERLAP\n");
+	printf("#define BM_OVERLAP\t0x1\n");
+	printf("#endif\n\n");
+
+	printf("static inline int bm_next_shift_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, const uint8_t *match,\n");
+	printf("\t\tint flags)\n");
+	printf("{\n");
+	printf("\treturn match - text + %d - 1 + "
+	       "(flags & BM_OVERLAP ? %u : %d);\n",
+	       patlen, bm->match_shift, patlen);
+	printf("}\n\n");
+
+	printf("static inline uint32_t bm_find_all_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len, int flags,\n");
+	printf("\t\tint (*match)(uint32_t off, void *arg), void *arg)\n");
+	printf("{\n");
+	printf("\tint shift = %d - 1, known = 0;\n", patlen);
+	printf("\tuint32_t nr = 0;\n");
+	printf("\tuint8_t *p;\n\n");
+	printf("\twhile ((p = bm_scan_");
+	PATTERN_STR;
+	printf("(text, len, shift, known))) {\n");
+	printf("\t\tnr++;\n");
+	printf("\t\tif (match && match(p - text, arg))\n");
+	printf("\t\t\tbreak;\n");
+	printf("\t\tshift = bm_next_shift_");
+	PATTERN_STR;
+	printf("(text, p, flags);\n");
+	if (bm->match_shift < patlen)
+		printf("\t\tknown = flags & BM_OVERLAP ? %u : 0;\n",
+		       patlen - bm->match_shift);
+	printf("\t}\n");
+	printf("\treturn nr;\n");
 	printf("}\n\n");
+
+	printf("static inline uint32_t bm_count_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len, int flags)\n");
+	printf("{\n");
+	printf("\treturn bm_find_all_");
+	PATTERN_STR;
+	printf("(text, len, flags, NULL, NULL);\n");
+	printf("}\n\n");
+
+	printf("static inline uint32_t bm_find_offs_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len, int flags,\n");
+	printf("\t\tuint32_t *offs, uint32_t max)\n");
+	printf("{\n");
+	printf("\tint shift = %d - 1, known = 0;\n", patlen);
+	printf("\tuint32_t nr = 0;\n");
+	printf("\tuint8_t *p;\n\n");
+	printf("\twhile (nr < max && (p = bm_scan_");
+	PATTERN_STR;
+	printf("(text, len, shift, known))) {\n");
+	printf("\t\toffs[nr++] = p - text;\n");
+	printf("\t\tshift = bm_next_shift_");
+	PATTERN_STR;
+	printf("(text, p, flags);\n");
+	if (bm->match_shift < patlen)
+		printf("\t\tknown = flags & BM_OVERLAP ? %u : 0;\n",
+		       patlen - bm->match_shift);
+	printf("\t}\n");
+	printf("\treturn nr;\n");
+	printf("}\n");
 }
 
-static void build_bs_pre(void)
+/*
+ * SIMD front end: the pattern's first and last bytes (the two rarest with
+ * --profile) are compared at 16 (SSE2) or 32 (AVX2) alignments per
+ * instruction, and only the candidates left are verified, with whole-word
+ * compares against constant chunks of the pattern. The scalar BM above
+ * takes the tail of the text and is the fallback when the CPU has none of
+ * these.
+ *
+ * With -i the pattern is lower case, and x | 0x20 equals a lower case letter
+ * only when x is that letter in either case: the letters are compared after
+ * an OR, in the vectors as in the chunks, other bytes as they are.
+ */
+static uint64_t pattern_chunk(int off, int size)
 {
-	printf("static inline int get_bs_");
+	uint64_t v = 0;
+	int i;
+
+	/* x86 only, so little endian */
+	for (i = size - 1; i >= 0; i--)
+		v = (v << 8) | (uint8_t)pattern[off + i];
+	return v;
+}
+
+/* 0x20 on the letters of the chunk with -i */
+static uint64_t pattern_fold(int off, int size)
+{
+	uint64_t v = 0;
+	int i;
+
+	if (!ignorecase)
+		return 0;
+	for (i = size - 1; i >= 0; i--)
+		v = (v << 8) | (isalpha((uint8_t)pattern[off + i]) ? 0x20 : 0);
+	return v;
+}
+
+static void build_eq_chunk(int off, int size)
+{
+	uint64_t fold = pattern_fold(off, size);
+
+	static const char *type[] = {
+		[1] = "uint8_t", [2] = "uint16_t",
+		[4] = "uint32_t", [8] = "uint64_t",
+	};
+
+	printf("\t{\n");
+	printf("\t\t%s w;\n", type[size]);
+	printf("\t\tmemcpy(&w, p + %d, %d);\n", off, size);
+	if (fold)
+		printf("\t\tif ((w | 0x%llXULL) != 0x%llXULL)\n",
+		       (unsigned long long)fold,
+		       (unsigned long long)pattern_chunk(off, size));
+	else
+		printf("\t\tif (w != 0x%llXULL)\n",
+		       (unsigned long long)pattern_chunk(off, size));
+	printf("\t\t\treturn 0;\n");
+	printf("\t}\n");
+}
+
+static void build_eq(void)
+{
+	int off, size;
+
+	printf("static inline int bm_eq_");
 	PATTERN_STR;
-	printf("(int i)\n");
+	printf("(const uint8_t *p)\n");
 	printf("{\n");
-	printf("\tswitch (i) {\n");
-	printf("\tdefault: return %d;\n", patlen);
+	for (size = 8; size > patlen; size >>= 1)
+		;
+	/* The last chunk overlaps the previous one instead of a tail loop */
+	for (off = 0; off + size < patlen; off += size)
+		build_eq_chunk(off, size);
+	build_eq_chunk(patlen - size, size);
+	printf("\treturn 1;\n");
+	printf("}\n\n");
 }
 
-static void build_bs_post(void)
+struct simd_isa
 {
+	const char *name;
+	int width;
+	const char *vec;
+	const char *pfx;
+	const char *load;
+};
+
+static const struct simd_isa simd_isa[] = {
+	{ "avx2", 32, "__m256i", "_mm256", "_mm256_loadu_si256" },
+	{ "sse2", 16, "__m128i", "_mm", "_mm_loadu_si128" },
+};
+
+/* Equality mask of the pattern byte at i with the vector v, bytes c */
+static void build_simd_cmp(const struct simd_isa *isa, const char *v, int i,
+			   const char *c)
+{
+	if (ignorecase && isalpha((uint8_t)pattern[i]))
+		printf("%s_cmpeq_epi8(%s_or_si%d(%s, %s_set1_epi8(0x20)), %s)",
+		       isa->pfx, isa->pfx, isa->width * 8, v, isa->pfx, c);
+	else
+		printf("%s_cmpeq_epi8(%s, %s)", isa->pfx, v, c);
+}
+
+static void build_simd_find(const struct simd_isa *isa)
+{
+	/* First and last bytes, the two rarest ones with a profile */
+	int p0 = prof_nr > 1 ? prof_pos[0] : 0;
+	int p1 = prof_nr > 1 ? prof_pos[1] : patlen - 1;
+
+	printf("__attribute__((target(\"%s\")))\n", isa->name);
+	printf("static inline uint8_t *bm_find_");
+	PATTERN_STR;
+	printf("_%s(const uint8_t *text, uint32_t len)\n", isa->name);
+	printf("{\n");
+	printf("\tconst %s first = %s_set1_epi8((char)0x%X);\n",
+	       isa->vec, isa->pfx, (uint8_t)pattern[p0]);
+	printf("\tconst %s last = %s_set1_epi8((char)0x%X);\n",
+	       isa->vec, isa->pfx, (uint8_t)pattern[p1]);
+	printf("\tuint32_t i, bit, mask;\n");
+	if (linear)
+		printf("\tuint32_t work = 0;\n");
+	build_stats_get(NULL);
+	printf("\n");
+	printf("\tfor (i = 0; i + %d <= len; i += %d) {\n",
+	       isa->width + patlen - 1, isa->width);
+	if (p0)
+		printf("\t\t%s a = %s((const %s *)(text + i + %d));\n",
+		       isa->vec, isa->load, isa->vec, p0);
+	else
+		printf("\t\t%s a = %s((const %s *)(text + i));\n",
+		       isa->vec, isa->load, isa->vec);
+	printf("\t\t%s b = %s((const %s *)(text + i + %d));\n",
+	       isa->vec, isa->load, isa->vec, p1);
+	printf("\t\tmask = %s_movemask_epi8(%s_and_si%d(\n\t\t\t",
+	       isa->pfx, isa->pfx, isa->width * 8);
+	build_simd_cmp(isa, "a", p0, "first");
+	printf(",\n\t\t\t");
+	build_simd_cmp(isa, "b", p1, "last");
+	printf("));\n");
+	/* A block is a window, and its two vector compares */
+	printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+	printf("\t\tTS_BM_STAT(st, compares, %d);\n", 2 * isa->width);
+	printf("\t\tTS_BM_STAT_SHIFT(st, %d);\n", isa->width);
+	printf("\t\twhile (mask) {\n");
+	printf("\t\t\tbit = __builtin_ctz(mask);\n");
+	if (linear) {
+		printf("\t\t\twork += %d;\n", patlen);
+		printf("\t\t\tif (work > 2 * i + %d) {\n", 64 * patlen);
+		printf("\t\t\t\tTS_BM_STAT(st, bytes, i);\n");
+		printf("\t\t\t\treturn bm_find_");
+		PATTERN_STR;
+		printf("_scalar(text + i, len - i);\n");
+		printf("\t\t\t}\n");
+	}
+	printf("\t\t\tTS_BM_STAT(st, verified, 1);\n");
+	printf("\t\t\tTS_BM_STAT(st, compares, %d);\n", patlen);
+	printf("\t\t\tif (bm_eq_");
+	PATTERN_STR;
+	printf("(text + i + bit))\n");
+	printf("\t\t\t\treturn TS_BM_STAT_RET(st, 0, i + bit + %d,\n",
+	       patlen);
+	printf("\t\t\t\t\t(uint8_t *)text + i + bit);\n");
+	printf("\t\t\tmask &= mask - 1;\n");
+	printf("\t\t}\n");
 	printf("\t}\n");
+	printf("\tTS_BM_STAT(st, bytes, i);\n");
+	printf("\treturn i < len ? bm_find_");
+	PATTERN_STR;
+	printf("_scalar(text + i, len - i) : NULL;\n");
 	printf("}\n\n");
 }
 
-static void build_shift(int i, int r)
+static void build_simd(void)
 {
-	printf("\tcase %d: return %d;\n", i, r);
+	int i;
+
+	printf("\n#if defined(__x86_64__) || defined(__i386__)\n");
+	printf("#include <immintrin.h>\n\n");
+	build_eq();
+	for (i = 0; i < sizeof(simd_isa) / sizeof(simd_isa[0]); i++)
+		build_simd_find(&simd_isa[i]);
+	printf("#endif\n\n");
+
+	printf("static inline uint8_t *bm_find_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len)\n");
+	printf("{\n");
+	printf("#if defined(__x86_64__) || defined(__i386__)\n");
+	for (i = 0; i < sizeof(simd_isa) / sizeof(simd_isa[0]); i++) {
+		printf("\tif (__builtin_cpu_supports(\"%s\"))\n",
+		       simd_isa[i].name);
+		printf("\t\treturn bm_find_");
+		PATTERN_STR;
+		printf("_%s(text, len);\n", simd_isa[i].name);
+	}
+	printf("#endif\n");
+	printf("\treturn bm_find_");
+	PATTERN_STR;
+	printf("_scalar(text, len);\n");
+	printf("}\n");
 }
 
-static int subpattern(uint8_t *pattern, int i, int j, int g)
+/* Same as bm_find_stream(), the held bytes are sized at build time */
+static void build_stream(void)
 {
-	int x = i+g-1, y = j+g-1, ret = 0;
+	int keep = patlen - 1;
 
-	while(pattern[x--] == pattern[y--]) {
-		if (y < 0) {
-			ret = 1;
-			break;
-		}
-		if (--g == 0) {
-			ret = pattern[i-1] != pattern[j-1];
-			break;
-		}
+	printf("\nstruct bm_stream_");
+	PATTERN_STR;
+	printf(" {\n");
+	printf("\tuint64_t offset;\n");
+	printf("\tuint32_t held;\n");
+	printf("\tuint8_t buf[%d];\n", 2 * keep + 1);
+	printf("};\n\n");
+
+	printf("static inline void bm_stream_init_");
+	PATTERN_STR;
+	printf("(struct bm_stream_");
+	PATTERN_STR;
+	printf(" *ctx)\n");
+	printf("{\n");
+	printf("\tctx->offset = 0;\n");
+	printf("\tctx->held = 0;\n");
+	printf("}\n\n");
+
+	printf("static inline int64_t bm_find_stream_");
+	PATTERN_STR;
+	printf("(struct bm_stream_");
+	PATTERN_STR;
+	printf(" *ctx,\n");
+	printf("\t\tconst uint8_t *chunk, uint32_t len)\n");
+	printf("{\n");
+	printf("\tuint32_t n = ctx->held;\n");
+	printf("\tint64_t ret = -1;\n");
+	printf("\tuint8_t *p;\n\n");
+	printf("\tif (n) {\n");
+	printf("\t\tn += len < %d ? len : %d;\n", keep, keep);
+	printf("\t\tmemcpy(ctx->buf + ctx->held, chunk, n - ctx->held);\n");
+	printf("\t\tp = bm_find_");
+	PATTERN_STR;
+	printf("(ctx->buf, n);\n");
+	printf("\t\tif (p && p - ctx->buf < ctx->held)\n");
+	printf("\t\t\tret = ctx->offset - ctx->held + (p - ctx->buf);\n");
+	printf("\t}\n");
+	printf("\tif (ret < 0) {\n");
+	printf("\t\tp = bm_find_");
+	PATTERN_STR;
+	printf("(chunk, len);\n");
+	printf("\t\tif (p)\n");
+	printf("\t\t\tret = ctx->offset + (p - chunk);\n");
+	printf("\t}\n");
+	printf("\tif (len >= %d) {\n", keep);
+	printf("\t\tmemcpy(ctx->buf, chunk + len - %d, %d);\n", keep, keep);
+	printf("\t\tctx->held = %d;\n", keep);
+	printf("\t} else {\n");
+	printf("\t\tif (ctx->held == 0) {\n");
+	printf("\t\t\tmemcpy(ctx->buf, chunk, len);\n");
+	printf("\t\t\tn = len;\n");
+	printf("\t\t}\n");
+	printf("\t\tif (n > %d) {\n", keep);
+	printf("\t\t\tmemmove(ctx->buf, ctx->buf + n - %d, %d);\n", keep, keep);
+	printf("\t\t\tn = %d;\n", keep);
+	printf("\t\t}\n");
+	printf("\t\tctx->held = n;\n");
+	printf("\t}\n");
+	printf("\tctx->offset += len;\n");
+	printf("\treturn ret;\n");
+	printf("}\n");
+}
+
+/*
+ * get_<name>_(): a switch() over the entries differing from dflt, or with
+ * SHIFT_TABLE one load from a cache line aligned array sized to the
+ * pattern, instead of the compare chain or indirect jump of a switch().
+ */
+static void build_shift_fn(const char *name, const uint32_t *v, int n,
+			   uint32_t dflt)
+{
+	uint32_t vmax = 0;
+	int i;
+
+	if (shift_mode == SHIFT_TABLE) {
+		for (i = 0; i < n; i++)
+			vmax = v[i] > vmax ? v[i] : vmax;
+		printf("static const %s %s_tbl_", vmax < 0x100 ? "uint8_t" :
+		       vmax < 0x10000 ? "uint16_t" : "uint32_t", name);
+		PATTERN_STR;
+		printf("[%d]\n\t__attribute__((aligned(64))) = {", n);
+		for (i = 0; i < n; i++)
+			printf("%s%u,", (i % 16) == 0 ? "\n\t" : " ", v[i]);
+		printf("\n};\n\n");
+	}
+
+	printf("static inline int get_%s_", name);
+	PATTERN_STR;
+	printf("(int i)\n");
+	printf("{\n");
+	if (shift_mode == SHIFT_TABLE) {
+		printf("\treturn %s_tbl_", name);
+		PATTERN_STR;
+		printf("[i];\n");
+	} else {
+		printf("\tswitch (i) {\n");
+		printf("\tdefault: return %u;\n", dflt);
+		for (i = 0; i < n; i++)
+			if (v[i] != dflt)
+				printf("\tcase %d: return %u;\n", i, v[i]);
+		printf("\t}\n");
 	}
+	printf("}\n\n");
+}
+
+/*
+ * q-gram shifts as bm_find() on long patterns, q = 2 below TS_BM_QGRAM2.
+ * Candidates past twice the text scanned go to the BM of bm_scan_*().
+ */
+static void build_hashq(struct ts_bm *bm)
+{
+	uint32_t q = bm_qgram(patlen) ? bm_qgram(patlen) : 2, i, qmatch;
+	char start[64], ret[64];
+	uint32_t qs[TS_BM_QSIZE];
+	uint16_t tbl[TS_BM_QSIZE];
 
-	return ret;
+	bm_qgram_shift(bm_pattern(bm), patlen, q, tbl, &qmatch);
+	for (i = 0; i < TS_BM_QSIZE; i++)
+		qs[i] = tbl[i];
+	printf("\n");
+	build_shift_fn("hq", qs, TS_BM_QSIZE, min_t(uint32_t, patlen - q + 1,
+						   0xffff));
+
+	printf("static inline uint32_t bm_qhash_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t i)\n");
+	printf("{\n");
+	printf("\tuint32_t g = ");
+	if (q == 3) {
+		build_text("i - 2");
+		printf(" << 16 | ");
+	}
+	build_text("i - 1");
+	printf(" << 8 | ");
+	build_text("i");
+	printf(";\n\n");
+	printf("\treturn (g * 0x%XU) >> %d;\n", 0x9E3779B1U,
+	       32 - TS_BM_QBITS);
+	printf("}\n\n");
+
+	build_find_proto();
+	printf("{\n");
+	build_pattern();
+	printf("\tuint32_t shift = %d - 1, sh, work = 0;\n", patlen);
+	printf("\tint i;\n");
+	build_stats_get(NULL);
+	printf("\n");
+	printf("\twhile (shift < len) {\n");
+	printf("\t\tTS_BM_STAT(st, windows, 1);\n");
+	printf("\t\tsh = get_hq_");
+	PATTERN_STR;
+	printf("(bm_qhash_");
+	PATTERN_STR;
+	printf("(text, shift));\n");
+	printf("\t\tif (sh) {\n");
+	printf("\t\t\tTS_BM_STAT_SHIFT(st, sh);\n");
+	printf("\t\t\tshift += sh;\n");
+	printf("\t\t\tcontinue;\n");
+	printf("\t\t}\n");
+	printf("\t\twork += %d;\n", patlen);
+	printf("\t\tif (work > 2 * shift + %d) {\n", 64 * patlen);
+	printf("\t\t\tTS_BM_STAT(st, bytes, shift - %d + 1);\n", patlen);
+	printf("\t\t\treturn bm_scan_");
+	PATTERN_STR;
+	printf("(text, len, shift, 0);\n");
+	printf("\t\t}\n");
+	snprintf(start, sizeof(start), "shift - %d + 1 + i", patlen);
+	snprintf(ret, sizeof(ret), "(uint8_t *)text + shift - %d + 1", patlen);
+	build_verify(0, start, ret, "shift + 1");
+	printf("\t\tTS_BM_STAT_SHIFT(st, %u);\n", qmatch);
+	printf("\t\tshift += %u;\n", qmatch);
+	printf("\t}\n");
+	printf("\treturn TS_BM_STAT_RET(st, 0, len, NULL);\n");
+	printf("}\n");
 }
 
-static void compute_prefix_tbl(struct ts_bm *bm)
+static void build_file(struct ts_bm *bm)
 {
-	int i, j, g;
+	uint32_t qs[ASIZE];
+	int i, nr_bs = 0, nr_gs = 0;
 
-	for (i = 0; i < ASIZE; i++)
-		bm->bad_shift[i] = bm->patlen;
-	for (i = 0; i < bm->patlen - 1; i++) {
-		bm->bad_shift[bm->pattern[i]] = bm->patlen - 1 - i;
-		if (ignorecase)
-			bm->bad_shift[toupper(bm->pattern[i])]
-			    = bm->patlen - 1 - i;
+	if (algo == ALGO_AUTO) {
+		algo = algo_auto(bm);
+		if (linear && algo != ALGO_TWOWAY && algo != ALGO_HASHQ)
+			algo = ALGO_BM;
+		/* The profile takes over the early checks of Raita */
+		else if (prof_nr && (algo == ALGO_BM || algo == ALGO_RAITA))
+			algo = ALGO_HORSPOOL;
 	}
+	/* No q-gram in a single byte */
+	if (algo == ALGO_HASHQ && patlen < 2)
+		algo = ALGO_BM;
+	for (i = 0; i < ASIZE; i++)
+		nr_bs += bm->bad_shift[i] != bm->patlen;
+	for (i = 1; i < bm->patlen; i++)
+		nr_gs += bm->good_shift[i] != bm->patlen;
+	if (shift_mode == SHIFT_AUTO)
+		shift_mode = nr_bs > SHIFT_SWITCH_MAX ||
+			nr_gs > SHIFT_SWITCH_MAX ? SHIFT_TABLE : SHIFT_SWITCH;
+
+	build_file_pre();
+	build_shift_fn("bs", bm->bad_shift, ASIZE, bm->patlen);
 
 	/* Compute the good shift array, used to match reocurrences
 	 * of a subpattern */
-	bm->good_shift[0] = 1;
-	for (i = 1; i < bm->patlen; i++)
-		bm->good_shift[i] = bm->patlen;
-        for (i = bm->patlen-1, g = 1; i > 0; g++, i--) {
-		for (j = i-1; j >= 1-g ; j--)
-			if (subpattern(bm->pattern, i, j, g)) {
-				bm->good_shift[g] = bm->patlen-j-g;
-				break;
+	build_shift_fn("gs", bm->good_shift, bm->patlen, bm->patlen);
+	build_file_post();
+
+	printf("\n/* bm_find_");
+	PATTERN_STR;
+	printf("%s(): %s */\n", simd ? "_scalar" : "", algo_name[algo]);
+	if (prof_nr) {
+		printf("/* Rarest in the profile:");
+		for (i = 0; i < prof_nr; i++)
+			printf(" pattern[%d]", prof_pos[i]);
+		printf(" */\n");
+	}
+	switch (algo) {
+	case ALGO_BM:
+		build_find_proto();
+		printf("{\n");
+		printf("\treturn bm_scan_");
+		PATTERN_STR;
+		printf("(text, len, %d - 1, 0);\n", patlen);
+		printf("}\n");
+		break;
+	case ALGO_HORSPOOL:
+	case ALGO_RAITA:
+		build_horspool(algo == ALGO_RAITA);
+		break;
+	case ALGO_SUNDAY:
+		for (i = 0; i < ASIZE; i++)
+			qs[i] = patlen + 1;
+		for (i = 0; i < patlen; i++) {
+			qs[(uint8_t)pattern[i]] = patlen - i;
+			if (ignorecase) {
+				qs[tolower((uint8_t)pattern[i])] = patlen - i;
+				qs[toupper((uint8_t)pattern[i])] = patlen - i;
 			}
+		}
+		printf("\n");
+		build_shift_fn("qs", qs, ASIZE, patlen + 1);
+		build_sunday();
+		break;
+	case ALGO_TWOWAY:
+		build_twoway();
+		break;
+	case ALGO_HASHQ:
+		build_hashq(bm);
+		break;
 	}
+	if (simd)
+		build_simd();
+	build_find_all(bm);
+	build_stream();
+	printf("#endif\n");
 }
 
-static void build_file(struct ts_bm *bm)
+/*
+ * Multi-pattern mode: every pattern of a list is compiled into one
+ * Aho-Corasick automaton, so the text is walked only once whatever the
+ * number of signatures. Case sensitive and case insensitive patterns are
+ * put into two automata, which are stepped side by side in the same loop.
+ *
+ *   [3] Efficient String Matching: An Aid to Bibliographic Search,
+ *       A.V. Aho and M.J. Corasick. Communications of the ACM,
+ *       18(6), 1975, pp. 333-340.
+ */
+struct mp_pattern
 {
-	int i;
+	uint8_t *pattern;
+	uint32_t patlen;
+	int ignorecase;
+};
 
-	build_file_pre();
-	build_bs_pre();
+struct ac_dfa
+{
+	uint32_t nr_states;
+	uint32_t nr_class;
+	uint8_t cls[ASIZE];
+	uint32_t *next;		/* [nr_states][nr_class] */
+	uint32_t *out;		/* [nr_states + 1], index into out_list */
+	uint32_t *out_list;
+	uint32_t nr_out;
+};
+
+static struct mp_pattern *mp_pats;
+static uint32_t mp_nr;
+
+static int mp_load(const char *file)
+{
+	struct mp_pattern *pats;
+	FILE *fp;
+	char *line = NULL, *src;
+	size_t size = 0;
+	int lineno = 0, icase, dflt = ignorecase;
+	uint32_t len;
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		perror(file);
+		return -1;
+	}
+	while (getline(&line, &size, fp) != -1) {
+		lineno++;
+		src = line;
+		icase = dflt;
+		if (strncmp(src, "-i ", 3) == 0) {
+			icase = 1;
+			src += 3;
+		}
+		if (*src == '#' || !isprint((uint8_t)*src))
+			continue;
+		pats = realloc(mp_pats, (mp_nr + 1) * sizeof(*mp_pats));
+		if (pats == NULL) {
+			fprintf(stderr, "Out of Memory.\n");
+			return -1;
+		}
+		mp_pats = pats;
+		mp_pats[mp_nr].pattern = calloc(1, strlen(src) + 1);
+		if (mp_pats[mp_nr].pattern == NULL) {
+			fprintf(stderr, "Out of Memory.\n");
+			return -1;
+		}
+		len = bm_parse_pattern(src, mp_pats[mp_nr].pattern,
+				       icase ? TS_IGNORECASE : 0);
+		if (len == 0) {
+			fprintf(stderr, "%s:%d: Pattern Error.\n", file, lineno);
+			return -1;
+		}
+		mp_pats[mp_nr].patlen = len;
+		mp_pats[mp_nr].ignorecase = icase;
+		mp_nr++;
+	}
+	free(line);
+	fclose(fp);
+	if (mp_nr == 0) {
+		fprintf(stderr, "%s: No Pattern.\n", file);
+		return -1;
+	}
+	return 0;
+}
+
+static int ac_build(struct ac_dfa *ac, int icase)
+{
+	uint32_t *go, *fail, *head, *chain, *order, *map;
+	uint32_t i, n, s, t, c, k, total = 1, nr = 1, qh, qt;
+	int p;
+
+	memset(ac, 0, sizeof(*ac));
+	for (i = 0; i < mp_nr; i++)
+		if (mp_pats[i].ignorecase == icase)
+			total += mp_pats[i].patlen;
+	if (total == 1)
+		return 0;
 
-	for (i = 0; i < ASIZE; i++) {
-		if (bm->bad_shift[i] != bm->patlen)
-			build_shift(i, bm->bad_shift[i]);
+	go = calloc((size_t)total * ASIZE, sizeof(*go));
+	fail = calloc(total, sizeof(*fail));
+	head = malloc(total * sizeof(*head));
+	chain = malloc(mp_nr * sizeof(*chain));
+	order = malloc(total * sizeof(*order));
+	map = malloc(total * sizeof(*map));
+	if (!go || !fail || !head || !chain || !order || !map) {
+		fprintf(stderr, "Out of Memory.\n");
+		return -1;
 	}
-	build_bs_post();
+	memset(head, 0xFF, total * sizeof(*head));
 
-	/* Compute the good shift array, used to match reocurrences
-	 * of a subpattern */
-	build_gs_pre();
-	for (i = 1; i < bm->patlen; i++) {
-		if (bm->good_shift[i] != bm->patlen)
-			build_shift(i, bm->good_shift[i]);
+	/* Build the trie, reversed so that ids chain in ascending order */
+	for (p = mp_nr - 1; p >= 0; p--) {
+		if (mp_pats[p].ignorecase != icase)
+			continue;
+		for (i = 0, s = 0; i < mp_pats[p].patlen; i++) {
+			c = mp_pats[p].pattern[i];
+			if (icase)
+				c = tolower(c);
+			ac->cls[c] = 1;
+			if (go[s * ASIZE + c] == 0)
+				go[s * ASIZE + c] = nr++;
+			s = go[s * ASIZE + c];
+		}
+		chain[p] = head[s];
+		head[s] = p;
 	}
-	build_gs_post();
-	build_file_post();
+
+	/* Bytes never seen in a pattern share class 0 */
+	for (c = 0, k = 1; c < ASIZE; c++)
+		if (ac->cls[c])
+			ac->cls[c] = k++;
+	ac->nr_class = k;
+	if (icase)
+		for (c = 0; c < ASIZE; c++)
+			ac->cls[c] = ac->cls[tolower(c)];
+
+	/* Breadth-first: failure links, then complete the DFA */
+	qh = qt = 0;
+	order[qt++] = 0;
+	while (qh < qt) {
+		s = order[qh++];
+		for (c = 0; c < ASIZE; c++) {
+			t = go[s * ASIZE + c];
+			if (t) {
+				fail[t] = s ? go[fail[s] * ASIZE + c] : 0;
+				order[qt++] = t;
+			} else if (s) {
+				go[s * ASIZE + c] = go[fail[s] * ASIZE + c];
+			}
+		}
+	}
+
+	/* Renumber states in BFS order, hot states close to the root */
+	for (i = 0; i < nr; i++)
+		map[order[i]] = i;
+
+	ac->nr_states = nr;
+	ac->next = malloc((size_t)nr * ac->nr_class * sizeof(*ac->next));
+	ac->out = malloc((nr + 1) * sizeof(*ac->out));
+	if (!ac->next || !ac->out) {
+		fprintf(stderr, "Out of Memory.\n");
+		return -1;
+	}
+	for (i = 0; i < nr; i++) {
+		s = order[i];
+		for (c = 0; c < ASIZE; c++)
+			if (!icase || c == tolower(c))
+				ac->next[i * ac->nr_class + ac->cls[c]] =
+					map[go[s * ASIZE + c]];
+	}
+
+	/* Output sets: own patterns, then those of the failure state */
+	for (i = 0, n = 0; i < nr; i++) {
+		s = order[i];
+		ac->out[i] = n;
+		for (p = head[s]; p != -1; p = chain[p])
+			n++;
+		if (i)
+			n += ac->out[map[fail[s]] + 1] - ac->out[map[fail[s]]];
+		ac->out[i + 1] = n;
+		ac->out_list = realloc(ac->out_list, (n + 1) *
+				       sizeof(*ac->out_list));
+		if (ac->out_list == NULL) {
+			fprintf(stderr, "Out of Memory.\n");
+			return -1;
+		}
+		for (k = ac->out[i], p = head[s]; p != -1; p = chain[p])
+			ac->out_list[k++] = p;
+		if (i)
+			memcpy(ac->out_list + k,
+			       ac->out_list + ac->out[map[fail[s]]],
+			       (n - k) * sizeof(*ac->out_list));
+	}
+	ac->nr_out = n;
+
+	free(go);
+	free(fail);
+	free(head);
+	free(chain);
+	free(order);
+	free(map);
+	return 0;
 }
 
-static struct ts_bm *bm_init(const void *pattern, unsigned int len)
+static const char *ac_type(uint32_t n)
 {
-	struct ts_bm *bm;
+	if (n <= 0x100)
+		return "uint8_t";
+	if (n <= 0x10000)
+		return "uint16_t";
+	return "uint32_t";
+}
+
+static void ac_emit_tbl(const char *type, const char *name, const char *sfx,
+			const uint32_t *v, uint32_t n, uint32_t width)
+{
+	uint32_t i;
+
+	printf("static const %s %s_", type, name);
+	PATTERN_STR;
+	printf("%s[%u] = {", sfx, n);
+	for (i = 0; i < n; i++)
+		printf("%s%u,", (i % width) == 0 ? "\n\t" : " ", v[i]);
+	printf("\n};\n\n");
+}
+
+static void ac_emit(struct ac_dfa *ac, const char *sfx)
+{
+	uint32_t cls[ASIZE];
 	int i;
-	unsigned int prefix_tbl_len = len * sizeof(uint32_t);
-	size_t priv_size = sizeof(*bm) + len + prefix_tbl_len;
-
-	bm = calloc(1, priv_size);
-	bm->patlen = len;
-	bm->pattern = (uint8_t *) bm->good_shift + prefix_tbl_len;
-	memcpy(bm->pattern, pattern, len);
-	compute_prefix_tbl(bm);
-
-	fprintf(stderr, "%u-%s[%zu]\n", bm->patlen, bm->pattern, priv_size);
-	fprintf(stderr, "Bad Shift:\n");
-	for (i = 0; i < ASIZE; i++) {
-		if ((i % 16) == 0)
-			fprintf(stderr, "\n");
-		fprintf(stderr, "%d ", bm->bad_shift[i]);
-	}
-	fprintf(stderr, "\n");
-	fprintf(stderr, "Good Shift:\n");
-	for (i = 0; i < len; i++) {
-		if ((i % 16) == 0)
-			fprintf(stderr, "\n");
-		fprintf(stderr, "%d ", bm->good_shift[i]);
-	}
-	fprintf(stderr, "\n");
-	return bm;
-}
-
-static int parse_char(char *src, char *dst)
-{
-	int err, len = 0;
-	while (isprint(*src)) {
-		if (*src == '\\') {
-			switch (*(++src)) {
-			case 'a':
-				*dst = 0x07;
-				break;
-			case 'b':
-				*dst = 0x08;
-				break;
-			case 'f':
-				*dst = 0x0C;
-				break;
-			case 'n':
-				*dst = 0x0A;
-				break;
-			case 'r':
-				*dst = 0x0D;
-				break;
-			case 't':
-				*dst = 0x09;
-				break;
-			case 'v':
-				*dst = 0x0B;
-				break;
-			case 'x':
-				*dst = __hextou8((++src), &err);
-				if (err)
-					return 0;
-				++src;
-				break;
-			default:
-				return 0;
-			}
-		} else if (ignorecase)
-			*dst = tolower(*src);
+
+	for (i = 0; i < ASIZE; i++)
+		cls[i] = ac->cls[i];
+	ac_emit_tbl("uint8_t", "ac_cls", sfx, cls, ASIZE, 16);
+	ac_emit_tbl(ac_type(ac->nr_states), "ac_next", sfx, ac->next,
+		    ac->nr_states * ac->nr_class, ac->nr_class);
+	ac_emit_tbl("uint32_t", "ac_out", sfx, ac->out, ac->nr_states + 1, 16);
+	ac_emit_tbl(ac_type(mp_nr), "ac_ids", sfx, ac->out_list,
+		    ac->nr_out, 16);
+}
+
+static void ac_emit_step(struct ac_dfa *ac, const char *sfx, const char *s)
+{
+	printf("\t\t%s = ac_next_", s);
+	PATTERN_STR;
+	printf("%s[%s * %u + ac_cls_", sfx, s, ac->nr_class);
+	PATTERN_STR;
+	printf("%s[text[i]]];\n", sfx);
+	printf("\t\tfor (k = ac_out_");
+	PATTERN_STR;
+	printf("%s[%s]; k < ac_out_", sfx, s);
+	PATTERN_STR;
+	printf("%s[%s + 1]; k++) {\n", sfx, s);
+	printf("\t\t\tid = ac_ids_");
+	PATTERN_STR;
+	printf("%s[k];\n", sfx);
+	printf("\t\t\tnr++;\n");
+	printf("\t\t\tif (match && match(id, i + 1 - ac_len_");
+	PATTERN_STR;
+	printf("[id], arg))\n");
+	printf("\t\t\t\treturn nr;\n");
+	printf("\t\t}\n");
+}
+
+static void print_escaped(const uint8_t *str, uint32_t len)
+{
+	uint32_t i;
+
+	for (i = 0; i < len; i++)
+		if (isprint(str[i]) && str[i] != '\\' && str[i] != '*')
+			printf("%c", str[i]);
 		else
-			*dst = *src;
+			printf("\\x%02X", str[i]);
+}
 
-		src++;
-		dst++;
-		len++;
+static int build_multi(const char *file)
+{
+	struct ac_dfa ac, ac_i;
+	uint32_t i, *lens;
+	const char *base;
+
+	if (mp_load(file) || ac_build(&ac, 0) || ac_build(&ac_i, 1))
+		return EXIT_FAILURE;
+
+	/* Matcher is named after the pattern file */
+	base = strrchr(file, '/');
+	base = base ? base + 1 : file;
+	pattern = strdup(base);
+	if (strchr(pattern, '.') && strchr(pattern, '.') != pattern)
+		*strchr(pattern, '.') = '\0';
+	patlen = strlen(pattern);
+
+	build_file_pre();
+	printf("/*\n");
+	printf(" * Pattern IDs reported by ac_find_");
+	PATTERN_STR;
+	printf("():\n");
+	for (i = 0; i < mp_nr; i++) {
+		printf(" *   %u: %s\"", i, mp_pats[i].ignorecase ? "-i " : "");
+		print_escaped(mp_pats[i].pattern, mp_pats[i].patlen);
+		printf("\"\n");
 	}
-	return len;
+	printf(" */\n");
+	printf("#define AC_NR_");
+	PATTERN_STR;
+	printf("\t%u\n\n", mp_nr);
+
+	lens = malloc(mp_nr * sizeof(*lens));
+	if (lens == NULL) {
+		fprintf(stderr, "Out of Memory.\n");
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < mp_nr; i++)
+		lens[i] = mp_pats[i].patlen;
+	ac_emit_tbl("uint32_t", "ac_len", "", lens, mp_nr, 16);
+	if (ac.nr_states)
+		ac_emit(&ac, "");
+	if (ac_i.nr_states)
+		ac_emit(&ac_i, "_i");
+
+	printf("/*\n");
+	printf(" * Calls match() for every (pattern id, offset) found in text,\n");
+	printf(" * in order of end offset. A non-zero return from match() stops\n");
+	printf(" * the scan. Returns the number of matches reported.\n");
+	printf(" */\n");
+	printf("static inline uint32_t ac_find_");
+	PATTERN_STR;
+	printf("(const uint8_t *text, uint32_t len,\n");
+	printf("\t\tint (*match)(uint32_t id, uint32_t off, void *arg), "
+	       "void *arg)\n");
+	printf("{\n");
+	printf("\tuint32_t i, k, id, nr = 0;\n");
+	if (ac.nr_states)
+		printf("\t%s s = 0;\n", ac_type(ac.nr_states));
+	if (ac_i.nr_states)
+		printf("\t%s si = 0;\n", ac_type(ac_i.nr_states));
+	printf("\n");
+	printf("\tfor (i = 0; i < len; i++) {\n");
+	if (ac.nr_states)
+		ac_emit_step(&ac, "", "s");
+	if (ac_i.nr_states)
+		ac_emit_step(&ac_i, "_i", "si");
+	printf("\t}\n");
+	printf("\treturn nr;\n");
+	printf("}\n");
+	printf("#endif\n");
+	return EXIT_SUCCESS;
+}
+
+/*
+ * Extended syntax (-x): "?" is any byte, "[...]" a class of bytes and
+ * ranges, negated by a leading "^", "{n}" repeats the previous position n
+ * times and "\" escapes these meta chars. Each position being a set of
+ * bytes, the pattern is searched with Shift-Or, one bit per position:
+ *
+ *   [4] A New Approach to Text Searching, R. Baeza-Yates and G.H. Gonnet.
+ *       Communications of the ACM, 35(10), 1992, pp. 74-82.
+ *
+ * The cost per text byte is constant, whatever the text. Patterns of more
+ * than 64 positions take several words, carrying the bits from one to the
+ * next, up to XP_WORDS of them.
+ */
+#define XP_WORDS	4
+#define XP_MAX		(XP_WORDS * 64)
+
+struct xp_set
+{
+	uint64_t b[ASIZE / 64];
+};
+
+static struct xp_set xp_pos[XP_MAX];
+static uint32_t xp_len;
+
+static inline void xp_add(struct xp_set *set, uint8_t c)
+{
+	set->b[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline int xp_has(const struct xp_set *set, uint8_t c)
+{
+	return (set->b[c >> 6] >> (c & 63)) & 1;
+}
+
+/* With -i, both cases of the letters in the set */
+static void xp_fold(struct xp_set *set)
+{
+	int c;
+
+	if (ignorecase)
+		for (c = 0; c < ASIZE; c++)
+			if (xp_has(set, c)) {
+				xp_add(set, tolower(c));
+				xp_add(set, toupper(c));
+			}
+}
+
+/* One char or escape, 0 if there is none */
+static int xp_char(const char **src, uint8_t *c)
+{
+	int n;
+
+	if (!isprint((uint8_t)**src))
+		return 0;
+	if (**src != '\\') {
+		*c = *(*src)++;
+		return 1;
+	}
+	n = bm_parse_escape(*src + 1, c);
+	*src += n + 1;
+	return n;
+}
+
+static int xp_class(const char **src, struct xp_set *set)
+{
+	uint8_t lo, hi;
+	int neg, c, i;
+
+	neg = **src == '^';
+	*src += neg;
+	while (**src != ']') {
+		if (!xp_char(src, &lo))
+			return -1;
+		hi = lo;
+		if (**src == '-' && (*src)[1] != ']') {
+			(*src)++;
+			if (!xp_char(src, &hi) || hi < lo)
+				return -1;
+		}
+		for (c = lo; c <= hi; c++)
+			xp_add(set, c);
+	}
+	(*src)++;
+	/* [^a] with -i is neither a nor A */
+	xp_fold(set);
+	if (neg)
+		for (i = 0; i < ASIZE / 64; i++)
+			set->b[i] = ~set->b[i];
+	return 0;
+}
+
+/* Returns 0 if the pattern is a plain string, 1 if it has classes */
+static int xp_parse(const char *src)
+{
+	struct xp_set set;
+	int c, n, bits, classes = 0;
+	uint8_t ch;
+	char *end;
+
+	while (isprint((uint8_t)*src)) {
+		memset(&set, 0, sizeof(set));
+		switch (*src) {
+		case '?':
+			memset(&set, 0xff, sizeof(set));
+			src++;
+			break;
+		case '[':
+			src++;
+			if (xp_class(&src, &set))
+				return -1;
+			break;
+		case ']':
+		case '{':
+		case '}':
+			return -1;
+		default:
+			if (!xp_char(&src, &ch))
+				return -1;
+			xp_add(&set, ch);
+			break;
+		}
+		n = 1;
+		if (*src == '{') {
+			n = strtol(src + 1, &end, 10);
+			if (end == src + 1 || *end != '}' || n < 1)
+				return -1;
+			src = end + 1;
+		}
+		for (c = 0, bits = 0; c < ASIZE / 64; c++)
+			bits += __builtin_popcountll(set.b[c]);
+		classes |= bits > 1;
+		xp_fold(&set);
+		while (n--) {
+			if (xp_len == XP_MAX)
+				return -1;
+			xp_pos[xp_len++] = set;
+		}
+	}
+	if (xp_len == 0)
+		return -1;
+	return classes;
+}
+
+static void build_shift_or(void)
+{
+	uint32_t nw = (xp_len + 63) / 64, w, j;
+	uint64_t mask[XP_WORDS];
+	int c;
+
+	build_file_pre();
+	printf("/* Shift-Or, a bit is clear where the byte may be */\n");
+	printf("static const uint64_t so_mask_");
+	PATTERN_STR;
+	if (nw > 1)
+		printf("[256][%u] = {\n", nw);
+	else
+		printf("[256] = {");
+	for (c = 0; c < ASIZE; c++) {
+		/* The bits past the pattern are never read back */
+		for (w = 0; w < nw; w++)
+			mask[w] = SUF_MASK(min(64U, xp_len - w * 64));
+		for (j = 0; j < xp_len; j++)
+			if (xp_has(&xp_pos[j], c))
+				mask[j / 64] &= ~(1ULL << (j % 64));
+		if (nw == 1) {
+			printf("%s0x%016llX,", (c % 4) == 0 ? "\n\t" : " ",
+			       (unsigned long long)mask[0]);
+			continue;
+		}
+		printf("\t{");
+		for (w = 0; w < nw; w++)
+			printf(" 0x%016llX,", (unsigned long long)mask[w]);
+		printf(" },\n");
+	}
+	printf("%s};\n\n", nw > 1 ? "" : "\n");
+
+	build_find_proto();
+	printf("{\n");
+	for (w = 0; w < nw; w++)
+		printf("\tuint64_t d%u = ~0ULL;\n", w);
+	printf("\tuint32_t i;\n\n");
+	printf("\tfor (i = 0; i < len; i++) {\n");
+	if (nw == 1) {
+		printf("\t\td0 = d0 << 1 | so_mask_");
+		PATTERN_STR;
+		printf("[text[i]];\n");
+	} else {
+		printf("\t\tconst uint64_t *b = so_mask_");
+		PATTERN_STR;
+		printf("[text[i]];\n\n");
+		/* From the top, each word takes the last bit of the one below */
+		for (w = nw - 1; w > 0; w--)
+			printf("\t\td%u = (d%u << 1 | d%u >> 63) | b[%u];\n",
+			       w, w, w - 1, w);
+		printf("\t\td0 = d0 << 1 | b[0];\n");
+	}
+	printf("\t\tif (!(d%u & 0x%llXULL))\n", nw - 1,
+	       1ULL << ((xp_len - 1) % 64));
+	printf("\t\t\treturn (uint8_t *)text + i - %u;\n", xp_len - 1);
+	printf("\t}\n");
+	printf("\treturn NULL;\n");
+	printf("}\n");
+	printf("#endif\n");
+}
+
+/* Pattern positions of the rarest distinct bytes in a corpus sample */
+static int profile_load(const char *file)
+{
+	uint64_t freq[ASIZE] = { 0 };
+	uint8_t buf[65536], c;
+	int k, best, i;
+	size_t n, j;
+	FILE *f;
+
+	f = fopen(file, "r");
+	if (f == NULL)
+		return -1;
+	while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+		for (j = 0; j < n; j++)
+			freq[ignorecase ? ts_bm_fold[buf[j]] : buf[j]]++;
+	if (ferror(f)) {
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	/* Later positions win the ties, they are nearer the shift byte */
+	for (prof_nr = 0; prof_nr < PROFILE_CHECKS; prof_nr++) {
+		best = -1;
+		for (k = patlen - 1; k >= 0; k--) {
+			c = pattern[k];
+			for (i = 0; i < prof_nr; i++)
+				if ((uint8_t)pattern[prof_pos[i]] == c)
+					break;
+			if (i < prof_nr)
+				continue;
+			if (best < 0 || freq[c] < freq[(uint8_t)pattern[best]])
+				best = k;
+		}
+		if (best < 0)
+			break;
+		prof_pos[prof_nr] = best;
+	}
+	return 0;
 }
 
 static void usage(void)
 {
-	fprintf(stderr, "Usage: bm_build [-i] \"Pattern String\"\n");
+	fprintf(stderr, "Usage: bm_build [-i] [-s] [-L] [-t mode] [-a algo] "
+		"[-n name] [-x]\n"
+		"                [--profile corpus] \"Pattern String\"\n");
+	fprintf(stderr, "       bm_build [-i] -f Pattern_File\n");
 	fprintf(stderr, "       -i  -- Ignore Case in Pattern String\n");
+	fprintf(stderr, "       -s  -- Add SSE2/AVX2 candidate filter with "
+		"runtime CPU dispatch\n");
+	fprintf(stderr, "       -t  -- Shift lookup: \"table\", \"switch\" or "
+		"\"auto\" (default)\n");
+	fprintf(stderr, "       -a  -- Search algorithm: \"auto\" (default), "
+		"\"bm\", \"horspool\",\n");
+	fprintf(stderr, "              \"sunday\", \"raita\", \"twoway\" or "
+		"\"hashq\"\n");
+	fprintf(stderr, "       -L  -- Linear worst case: \"bm\", \"twoway\" "
+		"or \"hashq\" only, bounded SIMD\n");
+	fprintf(stderr, "       -x  -- Extended syntax: \"?\" any byte, "
+		"\"[a-z]\" \"[^...]\" classes,\n");
+	fprintf(stderr, "              \"{n}\" repeats, searched with "
+		"Shift-Or up to %d positions\n", XP_MAX);
+	fprintf(stderr, "       --profile -- Check first the pattern bytes "
+		"rarest in corpus\n");
+	fprintf(stderr, "       -n  -- Name the generated functions "
+		"bm_find_<name>() etc.\n");
+	fprintf(stderr, "       -f  -- Build one multi-pattern matcher for "
+		"every line of Pattern_File,\n");
+	fprintf(stderr, "              a line starting with \"-i \" ignores "
+		"case, \"#\" is a comment\n");
 }
 
+static const struct option long_opts[] = {
+	{ "profile", required_argument, NULL, 'P' },
+	{ NULL, 0, NULL, 0 },
+};
+
 int main(int argc, char *argv[])
 {
-	char *pat;
+	char *pat, *file = NULL, *profile = NULL;
+	struct ts_bm *bm;
+	int opt, c;
 	app_name = argv[0];
-	switch (argc) {
-	default:
-		usage();
-		exit(EXIT_FAILURE);
-	case 3:
-		if (memcmp("-i", argv[1], strlen(argv[1])) == 0)
+	while ((opt = getopt_long(argc, argv, "isLt:a:n:xf:", long_opts,
+				  NULL)) != -1) {
+		switch (opt) {
+		case 'i':
 			ignorecase = 1;
-		else {
+			break;
+		case 's':
+			simd = 1;
+			break;
+		case 'L':
+			linear = 1;
+			break;
+		case 't':
+			if (strcmp(optarg, "table") == 0)
+				shift_mode = SHIFT_TABLE;
+			else if (strcmp(optarg, "switch") == 0)
+				shift_mode = SHIFT_SWITCH;
+			else if (strcmp(optarg, "auto") == 0)
+				shift_mode = SHIFT_AUTO;
+			else {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'a':
+			for (algo = 0; algo < ALGO_NR; algo++)
+				if (strcmp(optarg, algo_name[algo]) == 0)
+					break;
+			if (algo == ALGO_NR) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'n':
+			sym = optarg;
+			for (pat = sym; *pat; pat++)
+				if (!isalnum(*pat) && *pat != '_')
+					break;
+			if (*pat || !*sym) {
+				usage();
+				exit(EXIT_FAILURE);
+			}
+			break;
+		case 'x':
+			extended = 1;
+			break;
+		case 'f':
+			file = optarg;
+			break;
+		case 'P':
+			profile = optarg;
+			break;
+		default:
 			usage();
 			exit(EXIT_FAILURE);
 		}
-		pat = argv[2];
-		break;
-	case 2:
-		pat = argv[1];
-		break;
 	}
+	if (linear && algo != ALGO_AUTO && algo != ALGO_BM &&
+	    algo != ALGO_TWOWAY && algo != ALGO_HASHQ) {
+		fprintf(stderr, "%s: -L with -a %s, not linear.\n", app_name,
+			algo_name[algo]);
+		exit(EXIT_FAILURE);
+	}
+	if (file) {
+		if (optind != argc) {
+			usage();
+			exit(EXIT_FAILURE);
+		}
+		return build_multi(file);
+	}
+	if (optind != argc - 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	pat = argv[optind];
 	patlen = strlen(pat);
 	pattern = calloc(1, patlen + 1);
-	patlen = parse_char(pat, pattern);
+	if (extended) {
+		switch (xp_parse(pat)) {
+		case 1:
+			/* Named after the source, folded in the masks */
+			strcpy(pattern, pat);
+			ignorecase = 0;
+			simd = 0;
+			build_shift_or();
+			return EXIT_SUCCESS;
+		case 0:
+			/* No class, the plain string goes to BM */
+			free(pattern);
+			pattern = calloc(1, xp_len + 1);
+			if (pattern == NULL) {
+				fprintf(stderr, "Out of Memory.\n");
+				return -1;
+			}
+			for (patlen = 0; patlen < xp_len; patlen++)
+				for (c = 0; c < ASIZE; c++)
+					if (xp_has(&xp_pos[patlen], c))
+						pattern[patlen] = ignorecase ?
+							ts_bm_fold[c] : c;
+			break;
+		default:
+			patlen = 0;
+			break;
+		}
+	} else
+		patlen = bm_parse_pattern(pat, (uint8_t *)pattern,
+					  ignorecase ? TS_IGNORECASE : 0);
 	if (patlen == 0) {
 		fprintf(stderr, "Pattern Error.\n");
 		return -1;
 	}
-	struct ts_bm *bm = bm_init(pattern, patlen);
+	bm = bm_init(pattern, patlen, ignorecase ? TS_IGNORECASE : 0);
+	if (bm == NULL) {
+		perror("bm_init");
+		return -1;
+	}
+	if (profile && profile_load(profile) < 0) {
+		perror(profile);
+		return -1;
+	}
+	bm_dump(bm, stderr);
 	build_file(bm);
+	bm_free(bm);
 	return EXIT_SUCCESS;
 }	/* ----------  end of function main  ---------- */
 
@@ -0,0 +1,451 @@
+/*
+ * bm_grep.c		Boyer-Moore scanner for large files
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Prints the byte offset of every match of the pattern in the files, or
+ *   their number with -c. Regular files are mapped and cut into chunks,
+ *   searched by a pool of threads: a chunk owns the matches starting in it
+ *   and is searched patlen - 1 bytes further, so none is lost across the
+ *   cuts. Each chunk collects its offsets apart, they are printed in file
+ *   order as soon as the chunks before are, and the threads only search a
+ *   few chunks ahead of the printed ones. Pipes and other files which
+ *   can't be mapped are read() and searched by the calling thread.
+ *
+ *   The workers find the overlapping matches to print: the non
+ *   overlapping ones (the default, as grep -o) are picked while merging,
+ *   which gives the same result as one sequential search whatever the
+ *   chunk cuts. With -c a chunk only counts its matches, non overlapping
+ *   ones from its start: when the last match of the chunks before runs
+ *   past its first one, the chunk is counted again from the end of it.
+ *
+ *   Built with -DTS_BM_STATS and lib/ts_bm_stats.c, the search counters of
+ *   all the workers are summed up to stderr at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "ts_bm.h"
+
+/* Chunks are searched with uint32_t lengths */
+#define GREP_CHUNK_MIN		(1U << 20)
+#define GREP_CHUNK_MAX		(4U << 20)
+/* Chunks searched ahead of the printed ones, per thread */
+#define GREP_AHEAD		2
+/* read() fallback buffer */
+#define GREP_READ_SIZE		(4U << 20)
+
+struct grep_chunk
+{
+	uint64_t start;		/* file offset */
+	uint32_t len;		/* bytes owned, matches start there */
+	uint32_t nr;		/* offsets held, or matches counted with -c */
+	uint32_t max;
+	uint32_t *offs;		/* match offsets from start */
+	uint32_t first;		/* -c: first match counted, from start */
+	uint32_t end;		/* -c: end of the last one counted */
+	int err;
+	int done;
+};
+
+struct grep_job
+{
+	const struct ts_bm *bm;
+	const char *name;
+	const uint8_t *text;
+	uint64_t size;
+	struct grep_chunk *chunks;
+	uint32_t nr_chunks;
+	uint32_t next;		/* next chunk to take */
+	uint32_t merged;	/* chunks merged, in file order */
+	uint32_t ahead;		/* chunks taken past the merged ones, at most */
+	uint64_t last;		/* end of the last match reported */
+	int err;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+};
+
+static struct ts_bm *bm;
+static int count_only, overlap, nr_threads;
+static uint64_t nr_total;
+
+static int grep_collect(uint32_t off, void *arg)
+{
+	struct grep_chunk *c = arg;
+	uint32_t *offs;
+
+	/* The next chunk owns it, and all the ones after */
+	if (off >= c->len)
+		return 1;
+	if (c->nr == c->max) {
+		c->max = c->max ? c->max * 2 : 64;
+		offs = realloc(c->offs, c->max * sizeof(*offs));
+		if (offs == NULL) {
+			c->err = ENOMEM;
+			return 1;
+		}
+		c->offs = offs;
+	}
+	c->offs[c->nr++] = off;
+	return 0;
+}
+
+static int grep_count(uint32_t off, void *arg)
+{
+	struct grep_chunk *c = arg;
+
+	if (off >= c->len)
+		return 1;
+	if (c->nr++ == 0)
+		c->first = off;
+	c->end = off + bm->patlen;
+	return 0;
+}
+
+/* The chunk's matches from text, patlen - 1 bytes past what it owns */
+static void grep_search(const struct grep_job *job, struct grep_chunk *c,
+			const uint8_t *text)
+{
+	uint64_t end = c->start + c->len + job->bm->patlen - 1;
+
+	if (end > job->size)
+		end = job->size;
+	if (!count_only)
+		bm_find_all(job->bm, text, job->text + end - text, BM_OVERLAP,
+			    grep_collect, c);
+	else
+		bm_find_all(job->bm, text, job->text + end - text,
+			    overlap ? BM_OVERLAP : 0, grep_count, c);
+}
+
+/*
+ * Ordered output of the matches, *last is the end of the last one printed
+ * and drops the overlapping ones unless -O.
+ */
+static void grep_report(const char *name, uint64_t off, uint64_t *last)
+{
+	if (!overlap && off < *last)
+		return;
+	*last = off + bm->patlen;
+	nr_total++;
+	if (count_only)
+		return;
+	if (name)
+		printf("%s:", name);
+	printf("%llu\n", (unsigned long long)off);
+}
+
+/*
+ * A chunk after all the ones before it. Its non overlapping count holds
+ * if the last match counted ends before its first one, else the chunk is
+ * counted again from there.
+ */
+static void grep_merge(struct grep_job *job, struct grep_chunk *c)
+{
+	struct grep_chunk tail = { 0 };
+	uint32_t i;
+
+	if (c->err && !job->err)
+		job->err = c->err;
+	if (job->err)
+		goto out;
+	if (!count_only) {
+		for (i = 0; i < c->nr; i++)
+			grep_report(job->name, c->start + c->offs[i],
+				    &job->last);
+		goto out;
+	}
+	if (c->nr == 0)
+		goto out;
+	if (overlap || job->last <= c->start + c->first) {
+		nr_total += c->nr;
+		job->last = c->start + c->end;
+		goto out;
+	}
+	if (job->last >= c->start + c->len)
+		goto out;
+	tail.start = job->last;
+	tail.len = c->start + c->len - job->last;
+	grep_search(job, &tail, job->text + tail.start);
+	if (tail.nr) {
+		nr_total += tail.nr;
+		job->last = tail.start + tail.end;
+	}
+out:
+	free(c->offs);
+	c->offs = NULL;
+}
+
+/*
+ * Chunks are taken in order, at most job->ahead past the first one not
+ * merged yet, so only that many hold offsets. The worker completing the
+ * first one merges it and all the done ones following.
+ */
+static void *grep_worker(void *arg)
+{
+	struct grep_job *job = arg;
+	struct grep_chunk *c;
+
+	pthread_mutex_lock(&job->lock);
+	for (;;) {
+		while (job->next < job->nr_chunks &&
+		       job->next - job->merged >= job->ahead)
+			pthread_cond_wait(&job->cond, &job->lock);
+		if (job->next == job->nr_chunks)
+			break;
+		c = &job->chunks[job->next++];
+		pthread_mutex_unlock(&job->lock);
+
+		grep_search(job, c, job->text + c->start);
+
+		pthread_mutex_lock(&job->lock);
+		c->done = 1;
+		while (job->merged < job->nr_chunks &&
+		       job->chunks[job->merged].done)
+			grep_merge(job, &job->chunks[job->merged++]);
+		pthread_cond_broadcast(&job->cond);
+	}
+	pthread_mutex_unlock(&job->lock);
+	return NULL;
+}
+
+static int grep_mmap(const char *name, const uint8_t *text, uint64_t size)
+{
+	struct grep_job job = {
+		.bm = bm, .name = name, .text = text, .size = size,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	pthread_t *tids;
+	uint64_t chunk, off;
+	uint32_t i, j;
+	int nr;
+
+	/* A few chunks per thread, so the fast ones take more */
+	chunk = size / ((uint64_t)nr_threads * 4) + 1;
+	if (chunk < GREP_CHUNK_MIN)
+		chunk = GREP_CHUNK_MIN;
+	if (chunk > GREP_CHUNK_MAX)
+		chunk = GREP_CHUNK_MAX;
+	job.nr_chunks = (size + chunk - 1) / chunk;
+	job.chunks = calloc(job.nr_chunks, sizeof(*job.chunks));
+	tids = calloc(nr_threads, sizeof(*tids));
+	if (job.chunks == NULL || tids == NULL) {
+		free(job.chunks);
+		free(tids);
+		return ENOMEM;
+	}
+	for (i = 0, off = 0; i < job.nr_chunks; i++, off += chunk) {
+		job.chunks[i].start = off;
+		job.chunks[i].len = size - off < chunk ? size - off : chunk;
+	}
+	/* Counts hold no offsets, nothing to bound */
+	job.ahead = count_only ? job.nr_chunks :
+		    (uint32_t)nr_threads * GREP_AHEAD;
+
+	nr = job.nr_chunks < nr_threads ? job.nr_chunks : nr_threads;
+	for (i = 1; i < nr; i++)
+		if (pthread_create(&tids[i], NULL, grep_worker, &job))
+			break;
+	grep_worker(&job);
+	for (j = 1; j < i; j++)
+		pthread_join(tids[j], NULL);
+
+	free(job.chunks);
+	free(tids);
+	return job.err;
+}
+
+/*
+ * The last patlen - 1 bytes of a buffer are moved ahead of the next one:
+ * the matches they start could not be complete yet, so none is reported
+ * twice.
+ */
+static int grep_read(const char *name, int fd)
+{
+	uint32_t keep = bm->patlen - 1, held = 0, from, i;
+	struct grep_chunk c = { 0 };
+	uint64_t pos = 0, last = 0;	/* pos: file offset of buf */
+	uint8_t *buf;
+	ssize_t n;
+	int ret = 0;
+
+	buf = malloc(keep + GREP_READ_SIZE);
+	if (buf == NULL)
+		return ENOMEM;
+	for (;;) {
+		n = read(fd, buf + held, GREP_READ_SIZE);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			ret = n < 0 ? errno : 0;
+			break;
+		}
+		n += held;
+		c.nr = 0;
+		if (count_only) {
+			/* Non overlapping ones from the end of the last */
+			from = !overlap && last > pos ? last - pos : 0;
+			c.len = n - from;
+			bm_find_all(bm, buf + from, n - from,
+				    overlap ? BM_OVERLAP : 0, grep_count, &c);
+			nr_total += c.nr;
+			if (c.nr)
+				last = pos + from + c.end;
+		} else {
+			c.len = n;
+			bm_find_all(bm, buf, n, BM_OVERLAP, grep_collect, &c);
+			if (c.err) {
+				ret = c.err;
+				break;
+			}
+			for (i = 0; i < c.nr; i++)
+				grep_report(name, pos + c.offs[i], &last);
+		}
+		held = n < keep ? n : keep;
+		memmove(buf, buf + n - held, held);
+		pos += n - held;
+	}
+	free(c.offs);
+	free(buf);
+	return ret;
+}
+
+static int grep_file(const char *file, const char *name)
+{
+	struct stat st;
+	uint8_t *text;
+	int fd, ret;
+
+	fd = strcmp(file, "-") ? open(file, O_RDONLY) : STDIN_FILENO;
+	if (fd < 0)
+		return errno;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		text = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (text != MAP_FAILED) {
+			madvise(text, st.st_size, MADV_SEQUENTIAL);
+			madvise(text, st.st_size, MADV_WILLNEED);
+			ret = grep_mmap(name, text, st.st_size);
+			munmap(text, st.st_size);
+			goto out;
+		}
+	}
+	ret = grep_read(name, fd);
+out:
+	if (fd != STDIN_FILENO)
+		close(fd);
+	return ret;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Usage: bm_grep [-i] [-c] [-O] [-j threads] "
+		"\"Pattern String\" [File...]\n");
+	fprintf(stderr, "       -i  -- Ignore Case in Pattern String\n");
+	fprintf(stderr, "       -c  -- Print the number of matches only\n");
+	fprintf(stderr, "       -O  -- Report overlapping matches too\n");
+	fprintf(stderr, "       -j  -- Worker threads, default one per CPU\n");
+	fprintf(stderr, "       Prints the byte offset of every match, "
+		"prefixed with the file name\n");
+	fprintf(stderr, "       if there are several files. No file or "
+		"\"-\" reads stdin.\n");
+	fprintf(stderr, "       Exits with 0 on a match, 1 without, "
+		"2 on error.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, flags = 0, i, ret, err = 0, found = 0;
+	uint8_t *pattern;
+	uint32_t patlen;
+	char *stdin_file[] = { "-" };
+	char **files;
+	int nr_files;
+
+	nr_threads = sysconf(_SC_NPROCESSORS_ONLN);
+	while ((opt = getopt(argc, argv, "icOj:")) != -1) {
+		switch (opt) {
+		case 'i':
+			flags |= TS_IGNORECASE;
+			break;
+		case 'c':
+			count_only = 1;
+			break;
+		case 'O':
+			overlap = 1;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		default:
+			usage();
+			exit(2);
+		}
+	}
+	if (optind >= argc) {
+		usage();
+		exit(2);
+	}
+	if (nr_threads < 1)
+		nr_threads = 1;
+
+	pattern = calloc(1, strlen(argv[optind]) + 1);
+	if (pattern == NULL) {
+		perror("bm_grep");
+		exit(2);
+	}
+	patlen = bm_parse_pattern(argv[optind], pattern, flags);
+	if (patlen == 0) {
+		fprintf(stderr, "Pattern Error.\n");
+		exit(2);
+	}
+	bm = bm_init(pattern, patlen, flags);
+	if (bm == NULL) {
+		perror("bm_init");
+		exit(2);
+	}
+
+	files = argv + optind + 1;
+	nr_files = argc - optind - 1;
+	if (nr_files == 0) {
+		files = stdin_file;
+		nr_files = 1;
+	}
+	setvbuf(stdout, NULL, _IOFBF, 1 << 16);
+	for (i = 0; i < nr_files; i++) {
+		nr_total = 0;
+		ret = grep_file(files[i], nr_files > 1 ? files[i] : NULL);
+		if (ret) {
+			fprintf(stderr, "bm_grep: %s: %s\n", files[i],
+				strerror(ret));
+			err = 1;
+			continue;
+		}
+		if (count_only && nr_files > 1)
+			printf("%s:", files[i]);
+		if (count_only)
+			printf("%llu\n", (unsigned long long)nr_total);
+		found |= nr_total != 0;
+	}
+#ifdef TS_BM_STATS
+	fflush(stdout);
+	bm_stats_dump(stderr);
+#endif
+	bm_free(bm);
+	free(pattern);
+	return err ? 2 : !found;
+}
@@ -0,0 +1,251 @@
+#ifndef __BSWAP_H
+#define __BSWAP_H
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * Bulk byte swaps: a buffer reversed end to end as by swap_dat(), and
+ * arrays of u16, u32 or u64 fields converted between byte orders, in place
+ * (dst == src) or into another array, never a partly overlapping one.
+ *
+ * On x86 one pshufb reverses 16 bytes at once (32 with AVX2), picked at
+ * run time; anywhere else, and for the tails, swap_dat() and the
+ * swap16/32/64() of common.h.
+ */
+
+static inline void __bswap_reverse_copy(uint8_t *dst, const uint8_t *src,
+					size_t len)
+{
+	while (len >= 8) {
+		len -= 8;
+		*(uint64_t *)dst = swap64(*(const uint64_t *)(src + len));
+		dst += 8;
+	}
+	while (len--)
+		*dst++ = src[len];
+}
+
+/* swap_dat() takes an int length, the outer bytes go first */
+static inline void __bswap_reverse(uint8_t *buf, size_t len)
+{
+	uint64_t a;
+
+	while (len >= 16) {
+		a = *(uint64_t *)buf;
+		*(uint64_t *)buf = swap64(*(uint64_t *)(buf + len - 8));
+		*(uint64_t *)(buf + len - 8) = swap64(a);
+		buf += 8;
+		len -= 16;
+	}
+	swap_dat(buf, len);
+}
+
+#define __BSWAP_ARRAY(bits)						\
+static inline void __bswap##bits##_array(uint##bits##_t *dst,		\
+					 const uint##bits##_t *src,	\
+					 size_t nr)			\
+{									\
+	size_t i;							\
+									\
+	for (i = 0; i < nr; i++)					\
+		dst[i] = swap##bits(src[i]);				\
+}
+__BSWAP_ARRAY(16)
+__BSWAP_ARRAY(32)
+__BSWAP_ARRAY(64)
+#undef __BSWAP_ARRAY
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__KERNEL__)
+#include <immintrin.h>
+
+/* pshufb controls, bytes reversed per 16, per u16, u32 and u64 */
+#define BSWAP_SHUF_REV	15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0
+#define BSWAP_SHUF_16	1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14
+#define BSWAP_SHUF_32	3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12
+#define BSWAP_SHUF_64	7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8
+
+__attribute__((target("ssse3")))
+static inline __m128i __bswap_rev_ssse3(__m128i v)
+{
+	return _mm_shuffle_epi8(v, _mm_setr_epi8(BSWAP_SHUF_REV));
+}
+
+/* The lanes swapped, then each one reversed */
+__attribute__((target("avx2")))
+static inline __m256i __bswap_rev_avx2(__m256i v)
+{
+	return _mm256_shuffle_epi8(_mm256_permute4x64_epi64(v, 0x4e),
+		_mm256_setr_epi8(BSWAP_SHUF_REV, BSWAP_SHUF_REV));
+}
+
+/* Both ends at once until they meet, swap_dat() for the middle */
+__attribute__((target("ssse3")))
+static inline void bswap_reverse_ssse3(uint8_t *buf, size_t len)
+{
+	__m128i a, b;
+
+	while (len >= 32) {
+		a = _mm_loadu_si128((const __m128i *)buf);
+		b = _mm_loadu_si128((const __m128i *)(buf + len - 16));
+		_mm_storeu_si128((__m128i *)buf, __bswap_rev_ssse3(b));
+		_mm_storeu_si128((__m128i *)(buf + len - 16),
+				 __bswap_rev_ssse3(a));
+		buf += 16;
+		len -= 32;
+	}
+	swap_dat(buf, len);
+}
+
+__attribute__((target("avx2")))
+static inline void bswap_reverse_avx2(uint8_t *buf, size_t len)
+{
+	__m256i a, b;
+
+	while (len >= 64) {
+		a = _mm256_loadu_si256((const __m256i *)buf);
+		b = _mm256_loadu_si256((const __m256i *)(buf + len - 32));
+		_mm256_storeu_si256((__m256i *)buf, __bswap_rev_avx2(b));
+		_mm256_storeu_si256((__m256i *)(buf + len - 32),
+				    __bswap_rev_avx2(a));
+		buf += 32;
+		len -= 64;
+	}
+	bswap_reverse_ssse3(buf, len);
+}
+
+__attribute__((target("ssse3")))
+static inline void bswap_reverse_copy_ssse3(uint8_t *dst,
+					    const uint8_t *src, size_t len)
+{
+	while (len >= 16) {
+		len -= 16;
+		_mm_storeu_si128((__m128i *)dst, __bswap_rev_ssse3(
+			_mm_loadu_si128((const __m128i *)(src + len))));
+		dst += 16;
+	}
+	__bswap_reverse_copy(dst, src, len);
+}
+
+__attribute__((target("avx2")))
+static inline void bswap_reverse_copy_avx2(uint8_t *dst, const uint8_t *src,
+					   size_t len)
+{
+	while (len >= 32) {
+		len -= 32;
+		_mm256_storeu_si256((__m256i *)dst, __bswap_rev_avx2(
+			_mm256_loadu_si256((const __m256i *)(src + len))));
+		dst += 32;
+	}
+	bswap_reverse_copy_ssse3(dst, src, len);
+}
+
+/*
+ * bswap16_array_ssse3() and so on: 16 (32 with AVX2) bytes of fields per
+ * pshufb, two vectors per round to keep both load ports busy
+ */
+#define __BSWAP_ARRAY_SIMD(bits)					\
+__attribute__((target("ssse3")))					\
+static inline void bswap##bits##_array_ssse3(uint##bits##_t *dst,	\
+					     const uint##bits##_t *src,	\
+					     size_t nr)			\
+{									\
+	const __m128i shuf = _mm_setr_epi8(BSWAP_SHUF_##bits);		\
+	const size_t step = 16 / sizeof(*src);				\
+	__m128i a, b;							\
+	size_t i;							\
+									\
+	for (i = 0; i + 2 * step <= nr; i += 2 * step) {		\
+		a = _mm_loadu_si128((const __m128i *)(src + i));	\
+		b = _mm_loadu_si128((const __m128i *)(src + i + step));	\
+		_mm_storeu_si128((__m128i *)(dst + i),			\
+				 _mm_shuffle_epi8(a, shuf));		\
+		_mm_storeu_si128((__m128i *)(dst + i + step),		\
+				 _mm_shuffle_epi8(b, shuf));		\
+	}								\
+	__bswap##bits##_array(dst + i, src + i, nr - i);		\
+}									\
+									\
+__attribute__((target("avx2")))						\
+static inline void bswap##bits##_array_avx2(uint##bits##_t *dst,	\
+					    const uint##bits##_t *src,	\
+					    size_t nr)			\
+{									\
+	const __m256i shuf = _mm256_setr_epi8(BSWAP_SHUF_##bits,	\
+					      BSWAP_SHUF_##bits);	\
+	const size_t step = 32 / sizeof(*src);				\
+	__m256i a, b;							\
+	size_t i;							\
+									\
+	for (i = 0; i + 2 * step <= nr; i += 2 * step) {		\
+		a = _mm256_loadu_si256((const __m256i *)(src + i));	\
+		b = _mm256_loadu_si256((const __m256i *)(src + i +	\
+							 step));	\
+		_mm256_storeu_si256((__m256i *)(dst + i),		\
+				    _mm256_shuffle_epi8(a, shuf));	\
+		_mm256_storeu_si256((__m256i *)(dst + i + step),	\
+				    _mm256_shuffle_epi8(b, shuf));	\
+	}								\
+	bswap##bits##_array_ssse3(dst + i, src + i, nr - i);		\
+}
+__BSWAP_ARRAY_SIMD(16)
+__BSWAP_ARRAY_SIMD(32)
+__BSWAP_ARRAY_SIMD(64)
+#undef __BSWAP_ARRAY_SIMD
+
+/* Below this many bytes the cpu checks cost more than the swaps */
+#define BSWAP_SIMD_MIN	32
+
+#define BSWAP_DISPATCH(name, len, ...) do {				\
+	if ((len) >= BSWAP_SIMD_MIN) {					\
+		if (__builtin_cpu_supports("avx2")) {			\
+			name##_avx2(__VA_ARGS__);			\
+			return;						\
+		}							\
+		if (__builtin_cpu_supports("ssse3")) {			\
+			name##_ssse3(__VA_ARGS__);			\
+			return;						\
+		}							\
+	}								\
+} while (0)
+#else
+#define BSWAP_DISPATCH(name, len, ...)	do { } while (0)
+#endif
+
+/* Reverses len bytes of buf in place, same result as swap_dat() */
+static inline void bswap_reverse(uint8_t *buf, size_t len)
+{
+	BSWAP_DISPATCH(bswap_reverse, len, buf, len);
+	__bswap_reverse(buf, len);
+}
+
+/* src reversed into dst, len bytes */
+static inline void bswap_reverse_copy(uint8_t *dst, const uint8_t *src,
+				      size_t len)
+{
+	BSWAP_DISPATCH(bswap_reverse_copy, len, dst, src, len);
+	__bswap_reverse_copy(dst, src, len);
+}
+
+/* nr fields of src byte swapped into dst, dst may be src */
+static inline void bswap16_array(uint16_t *dst, const uint16_t *src,
+				 size_t nr)
+{
+	BSWAP_DISPATCH(bswap16_array, nr * 2, dst, src, nr);
+	__bswap16_array(dst, src, nr);
+}
+
+static inline void bswap32_array(uint32_t *dst, const uint32_t *src,
+				 size_t nr)
+{
+	BSWAP_DISPATCH(bswap32_array, nr * 4, dst, src, nr);
+	__bswap32_array(dst, src, nr);
+}
+
+static inline void bswap64_array(uint64_t *dst, const uint64_t *src,
+				 size_t nr)
+{
+	BSWAP_DISPATCH(bswap64_array, nr * 8, dst, src, nr);
+	__bswap64_array(dst, src, nr);
+}
+
+#endif	/* __BSWAP_H */
@@ -1131,9 +1131,11 @@ static inline uint32_t str2maskip(uint32_t *mask, char *str, int *err)
 	++str;
 	if (strlen(str) < 3) {
 		uint8_t bit_width = str2u8(str, err);
-		if (*err || bit_width > 32)
+		if (*err || bit_width > 32) {
+			*err = 1;
 			return 0;
-		*mask = ~0U << (32 - bit_width);
+		}
+		*mask = bit_width ? ~0U << (32 - bit_width) : 0;
 	} else {
 		*mask = dotted2u32(str, err);
 		if (*err)
@@ -1142,6 +1144,105 @@ static inline uint32_t str2maskip(uint32_t *mask, char *str, int *err)
 	return ip;
 }
 
+/*
+ * RFC 4291 text form into 16 bytes of dst, network order: up to 8 groups
+ * of 1 to 4 hex digits, one "::" for a run of zero groups, the last 32
+ * bits possibly as a dotted quad. *str is left after the address.
+ */
+static inline void __str2ipv6(char **str, uint8_t *dst, int *err)
+{
+	uint16_t w[8] = { 0 };
+	int n = 0, gap = -1, nd, i;
+	char *s = *str, *g;
+	uint32_t v;
+
+	*err = 1;
+	if (s[0] == ':') {
+		if (s[1] != ':')
+			return;
+		gap = 0;
+		s += 2;
+	}
+	while (n < 8) {
+		g = s;
+		for (v = 0, nd = 0; isxdigit((int)*s); s++) {
+			if (++nd > 4)
+				return;
+			v = v << 4 | (isdigit((int)*s) ? *s - '0' :
+				      (*s | 0x20) - 'a' + 10);
+		}
+		if (nd == 0)
+			break;
+		if (*s == '.') {
+			if (n > 6)
+				return;
+			s = g;
+			v = __dotted2u32(&s, err);
+			if (*err)
+				return;
+			/* __dotted2u32() takes a '.' past the 4th group too */
+			if (s[-1] == '.')
+				s--;
+			*err = 1;
+			w[n++] = v >> 16;
+			w[n++] = v & U16_MAX;
+			break;
+		}
+		w[n++] = v;
+		if (*s != ':')
+			break;
+		if (n == 8)
+			return;
+		if (s[1] == ':') {
+			if (gap >= 0)
+				return;
+			gap = n;
+			s += 2;
+			continue;
+		}
+		s++;
+		if (!isxdigit((int)*s))
+			return;
+	}
+	if (*s == ':' || (gap < 0 && n != 8) || (gap >= 0 && n > 7))
+		return;
+
+	for (i = 0; i < 8; i++) {
+		v = gap < 0 || i < gap ? w[i] :
+		    i >= 8 - (n - gap) ? w[i - (8 - n)] : 0;
+		dst[2 * i] = v >> 8;
+		dst[2 * i + 1] = v & U8_MAX;
+	}
+	*str = s;
+	*err = 0;
+}
+
+static inline void str2ipv6(uint8_t *dst, char *str, int *err)
+{
+	__str2ipv6(&str, dst, err);
+}
+
+/* "address/len", the prefix length returned, the address into ip */
+static inline uint8_t str2maskip6(uint8_t *ip, char *str, int *err)
+{
+	uint8_t bit_width;
+
+	__str2ipv6(&str, ip, err);
+	if (*err)
+		return 0;
+	if (*str != '/') {
+		*err = 1;
+		return 0;
+	}
+	++str;
+	bit_width = str2u8(str, err);
+	if (*err || bit_width > 128) {
+		*err = 1;
+		return 0;
+	}
+	return bit_width;
+}
+
 static inline uint8_t __hextou8(char *str, int *err)
 {
 	uint8_t ret = 0;
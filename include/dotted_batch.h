@@ -0,0 +1,213 @@
+#ifndef __DOTTED_BATCH_H
+#define __DOTTED_BATCH_H
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * Batch IPv4 parsing: a buffer of dotted quads, one per entry, entries
+ * separated by a delimiter, as log lines or a column of a config. Every
+ * entry gets the address and error flag dotted2u32() gives for it as a
+ * string of its own: four groups of digits of at most 255, leading zeros
+ * taken, separated by dots; what follows the fourth group is ignored.
+ *
+ * On x86 with SSSE3, 16 bytes of an entry are classified into digits and
+ * dots at once, the group lengths pick a pshufb control out of 81 which
+ * lines the digits up as hundreds, tens and ones of four u32 lanes, and
+ * two multiply-adds make the octets. Groups of 4 or more digits (leading
+ * zeros) and entries made of 16 digits and dots go to the scalar parser.
+ */
+
+/* dotted2u32() on the len bytes of s, which need no terminating NUL */
+static inline uint32_t __dotted2u32_len(const char *s, size_t len, int *err)
+{
+	const char *end = s + len;
+	uint32_t ret = 0, v;
+	int i, nd;
+
+	*err = 1;
+	for (i = 0; i < 4; i++) {
+		for (v = 0, nd = 0; s < end && *s >= '0' && *s <= '9';
+		     s++, nd++) {
+			v = v * 10 + *s - '0';
+			if (v > U8_MAX)
+				return 0;
+		}
+		if (nd == 0)
+			return 0;
+		ret = ret << 8 | v;
+		if (s < end && *s == '.')
+			s++;
+	}
+	*err = 0;
+	return ret;
+}
+
+/* Entry at p, up to the delimiter or the end, *next after the delimiter */
+static inline size_t __dotted_entry(const char *p, const char *end,
+				    char delim, const char **next)
+{
+	const char *q = memchr(p, delim, end - p);
+
+	*next = q ? q + 1 : end;
+	return (q ? q : end) - p;
+}
+
+static inline size_t dotted2u32_batch_scalar(const char *buf, size_t len,
+					     char delim, uint32_t *ip,
+					     uint8_t *err, size_t max)
+{
+	const char *p = buf, *end = buf + len, *next;
+	size_t n, elen;
+	int e;
+
+	for (n = 0; p < end && n < max; n++, p = next) {
+		elen = __dotted_entry(p, end, delim, &next);
+		ip[n] = __dotted2u32_len(p, elen, &e);
+		err[n] = e;
+	}
+	return n;
+}
+
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__KERNEL__)
+#include <immintrin.h>
+
+/*
+ * pshufb control for groups of a, b, c and d digits starting at 0: group k
+ * to bytes 4k..4k+2 right aligned, 0x80 (a zero) for the missing leading
+ * digits and byte 4k+3
+ */
+#define __DQ_B(s, l, j)		((j) < 3 - (l) ? 0x80 : (s) + (j) - (3 - (l)))
+#define __DQ_G(s, l)		__DQ_B(s, l, 0), __DQ_B(s, l, 1),	\
+				__DQ_B(s, l, 2), 0x80
+#define __DQ_SHUF(a, b, c, d)	{ __DQ_G(0, a), __DQ_G((a) + 1, b),	\
+				  __DQ_G((a) + (b) + 2, c),		\
+				  __DQ_G((a) + (b) + (c) + 3, d) }
+#define __DQ_D(a, b, c)		__DQ_SHUF(a, b, c, 1), __DQ_SHUF(a, b, c, 2), \
+				__DQ_SHUF(a, b, c, 3)
+#define __DQ_C(a, b)		__DQ_D(a, b, 1), __DQ_D(a, b, 2), __DQ_D(a, b, 3)
+#define __DQ_A(a)		__DQ_C(a, 1), __DQ_C(a, 2), __DQ_C(a, 3)
+
+/* By (a - 1) * 27 + (b - 1) * 9 + (c - 1) * 3 + d - 1 */
+static const uint8_t dotted_shuf[81][16] __attribute__((aligned(16))) = {
+	__DQ_A(1), __DQ_A(2), __DQ_A(3)
+};
+
+#undef __DQ_A
+#undef __DQ_C
+#undef __DQ_D
+#undef __DQ_SHUF
+#undef __DQ_G
+#undef __DQ_B
+
+__attribute__((target("ssse3")))
+static inline size_t dotted2u32_batch_ssse3(const char *buf, size_t len,
+					    char delim, uint32_t *ip,
+					    uint8_t *err, size_t max)
+{
+	const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+	const __m128i dot = _mm_set1_epi8('.'), dl = _mm_set1_epi8(delim);
+	const __m128i w = _mm_setr_epi8(100, 10, 1, 0, 100, 10, 1, 0,
+					100, 10, 1, 0, 100, 10, 1, 0);
+	const __m128i one = _mm_set1_epi16(1), u8max = _mm_set1_epi32(U8_MAX);
+	const __m128i pack = _mm_setr_epi8(12, 8, 4, 0, -1, -1, -1, -1,
+					   -1, -1, -1, -1, -1, -1, -1, -1);
+	const char *p = buf, *end = buf + len, *next;
+	uint32_t dm, digits, dots, e, p1, p2, p3, l1, l2, l3, l4;
+	char tail[16];
+	size_t n, left, elen;
+	__m128i v, d, x;
+	int ret;
+
+	for (n = 0; p < end && n < max; n++, p = next) {
+		left = end - p;
+		if (left >= 16) {
+			v = _mm_loadu_si128((const __m128i *)p);
+		} else {
+			memset(tail, 0, sizeof(tail));
+			memcpy(tail, p, left);
+			v = _mm_loadu_si128((const __m128i *)tail);
+		}
+
+		/* The delimiter in the same 16 bytes most of the time */
+		dm = _mm_movemask_epi8(_mm_cmpeq_epi8(v, dl));
+		if (left < 16)
+			dm &= (1U << left) - 1;
+		if (dm) {
+			elen = __builtin_ctz(dm);
+			next = p + elen + 1;
+		} else if (left <= 16) {
+			elen = left;
+			next = end;
+		} else {
+			elen = 16 + __dotted_entry(p + 16, end, delim, &next);
+		}
+
+		d = _mm_sub_epi8(v, zero);
+		digits = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(d, nine),
+							  d));
+		dots = _mm_movemask_epi8(_mm_cmpeq_epi8(v, dot));
+		if (elen < 16) {
+			digits &= (1U << elen) - 1;
+			dots &= (1U << elen) - 1;
+		}
+		/* First byte neither a digit nor a dot */
+		e = __builtin_ctz(~(digits | dots));
+		if (unlikely(e >= 16))
+			goto scalar;
+		/* The first 3 dots, all before it */
+		dots &= (1U << e) - 1;
+		p1 = __builtin_ctz(dots | 1U << 16);
+		dots &= dots - 1;
+		p2 = __builtin_ctz(dots | 1U << 16);
+		dots &= dots - 1;
+		p3 = __builtin_ctz(dots | 1U << 16);
+		if (p3 >= 16)
+			goto bad;
+		l1 = p1;
+		l2 = p2 - p1 - 1;
+		l3 = p3 - p2 - 1;
+		l4 = __builtin_ctz(~(digits >> (p3 + 1)));
+		if (!l1 || !l2 || !l3 || !l4)
+			goto bad;
+		if (unlikely(l1 > 3 || l2 > 3 || l3 > 3 || l4 > 3))
+			goto scalar;
+
+		x = _mm_shuffle_epi8(d, _mm_load_si128((const __m128i *)
+			dotted_shuf[(l1 - 1) * 27 + (l2 - 1) * 9 +
+				    (l3 - 1) * 3 + l4 - 1]));
+		x = _mm_madd_epi16(_mm_maddubs_epi16(x, w), one);
+		if (_mm_movemask_epi8(_mm_cmpgt_epi32(x, u8max)))
+			goto bad;
+		ip[n] = _mm_cvtsi128_si32(_mm_shuffle_epi8(x, pack));
+		err[n] = 0;
+		continue;
+bad:
+		ip[n] = 0;
+		err[n] = 1;
+		continue;
+scalar:
+		ip[n] = __dotted2u32_len(p, elen, &ret);
+		err[n] = ret;
+	}
+	return n;
+}
+#endif
+
+/*
+ * Parses the entries of buf, len bytes separated by delim, into ip[] in
+ * host order, with err[] as dotted2u32() sets it, up to max entries. A
+ * delimiter ending buf starts no entry, two in a row an empty, erroneous
+ * one. Returns the number of entries parsed.
+ */
+static inline size_t dotted2u32_batch(const char *buf, size_t len,
+				      char delim, uint32_t *ip, uint8_t *err,
+				      size_t max)
+{
+#if (defined(__x86_64__) || defined(__i386__)) && !defined(__KERNEL__)
+	if (__builtin_cpu_supports("ssse3"))
+		return dotted2u32_batch_ssse3(buf, len, delim, ip, err, max);
+#endif
+	return dotted2u32_batch_scalar(buf, len, delim, ip, err, max);
+}
+
+#endif	/* __DOTTED_BATCH_H */
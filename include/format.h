@@ -0,0 +1,264 @@
+#ifndef __FORMAT_H
+#define __FORMAT_H
+#include <stddef.h>
+#include "common.h"
+
+/*
+ * Direct formatters, the printf() free counterparts of NIPQUAD_FMT,
+ * NIP6QUAD_FMT, MACQUAD_FMT and TGMK_FMT: each writes into a buffer of
+ * the caller at least FMT_*_LEN bytes long, NUL terminated, and returns
+ * the length without the NUL. Decimal digits go two at a time out of a
+ * 200 byte table, hex ones a nibble at a time.
+ *
+ * The batch variants write nr entries separated by sep into a buffer of
+ * nr times FMT_*_LEN bytes, NUL terminated, and return the total length.
+ */
+
+#define FMT_IPV4_LEN	16	/* "255.255.255.255" */
+#define FMT_IPV6_LEN	46	/* "ffff:...:255.255.255.255", INET6_ADDRSTRLEN */
+#define FMT_MAC_LEN	18	/* "FF:FF:FF:FF:FF:FF" */
+#define FMT_U64_LEN	21	/* "18446744073709551615" */
+#define FMT_X64_LEN	17	/* "ffffffffffffffff" */
+#define FMT_TGMK_LEN	37	/* "16777215Ti 1023Gi 1023Mi 1023Ki 1023" */
+
+static const char fmt_digits2[200] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+static const char fmt_hex_lower[16] = "0123456789abcdef";
+static const char fmt_hex_upper[16] = "0123456789ABCDEF";
+
+/* 0 to 255, no NUL */
+static inline char *__fmt_u8(char *p, uint32_t v)
+{
+	if (v >= 100) {
+		*p++ = '0' + v / 100;
+		v %= 100;
+		memcpy(p, &fmt_digits2[v * 2], 2);
+		return p + 2;
+	}
+	if (v >= 10) {
+		memcpy(p, &fmt_digits2[v * 2], 2);
+		return p + 2;
+	}
+	*p++ = '0' + v;
+	return p;
+}
+
+/* Host order, as NIPQUAD() */
+static inline int fmt_ipv4(char *dst, uint32_t ip)
+{
+	char *p = dst;
+
+	p = __fmt_u8(p, ip >> 24);
+	*p++ = '.';
+	p = __fmt_u8(p, (ip >> 16) & U8_MAX);
+	*p++ = '.';
+	p = __fmt_u8(p, (ip >> 8) & U8_MAX);
+	*p++ = '.';
+	p = __fmt_u8(p, ip & U8_MAX);
+	*p = '\0';
+	return p - dst;
+}
+
+/* Lower case hex, no leading zeros, no NUL */
+static inline char *__fmt_x16(char *p, uint32_t v)
+{
+	if (v >= 0x1000)
+		*p++ = fmt_hex_lower[v >> 12];
+	if (v >= 0x100)
+		*p++ = fmt_hex_lower[(v >> 8) & 0xf];
+	if (v >= 0x10)
+		*p++ = fmt_hex_lower[(v >> 4) & 0xf];
+	*p++ = fmt_hex_lower[v & 0xf];
+	return p;
+}
+
+/*
+ * 16 bytes in network order, RFC 5952: lower case, no leading zeros, the
+ * longest run of two or more zero groups (the first of equal ones) as
+ * "::", and IPv4 mapped addresses as ::ffff:a.b.c.d
+ */
+static inline int fmt_ipv6(char *dst, const uint8_t *ip)
+{
+	int i, run = 0, best = 0, at = -1, start = 0;
+	uint32_t w[8];
+	char *p = dst;
+
+	for (i = 0; i < 8; i++) {
+		w[i] = ip[2 * i] << 8 | ip[2 * i + 1];
+		if (w[i]) {
+			run = 0;
+			continue;
+		}
+		if (run++ == 0)
+			start = i;
+		if (run > best) {
+			best = run;
+			at = start;
+		}
+	}
+	if (best < 2)
+		at = -1;
+
+	if (at == 0 && best == 5 && w[5] == 0xffff) {
+		memcpy(p, "::ffff:", 7);
+		return p + 7 - dst + fmt_ipv4(p + 7, load_be32(ip + 12));
+	}
+	for (i = 0; i < 8; i++) {
+		if (i == at) {
+			*p++ = ':';
+			if (i == 0)
+				*p++ = ':';
+			i += best - 1;
+			continue;
+		}
+		p = __fmt_x16(p, w[i]);
+		if (i < 7)
+			*p++ = ':';
+	}
+	*p = '\0';
+	return p - dst;
+}
+
+/* Upper case, as MACQUAD() */
+static inline int fmt_mac(char *dst, const uint8_t *mac)
+{
+	int i;
+
+	for (i = 0; i < 6; i++) {
+		dst[3 * i] = fmt_hex_upper[mac[i] >> 4];
+		dst[3 * i + 1] = fmt_hex_upper[mac[i] & 0xf];
+		dst[3 * i + 2] = ':';
+	}
+	dst[17] = '\0';
+	return 17;
+}
+
+static inline int fmt_u64(char *dst, uint64_t v)
+{
+	uint64_t t = v;
+	int len = 1, n;
+
+	while (t >= 10) {
+		t /= 10;
+		len++;
+	}
+	dst[len] = '\0';
+	for (n = len; v >= 100; v /= 100) {
+		n -= 2;
+		memcpy(dst + n, &fmt_digits2[(v % 100) * 2], 2);
+	}
+	if (v >= 10)
+		memcpy(dst, &fmt_digits2[v * 2], 2);
+	else
+		dst[0] = '0' + v;
+	return len;
+}
+
+/* Lower case, no leading zeros */
+static inline int fmt_x64(char *dst, uint64_t v)
+{
+	int len = (64 - clz64(v | 1) + 3) / 4, i;
+
+	for (i = len - 1; i >= 0; i--, v >>= 4)
+		dst[i] = fmt_hex_lower[v & 0xf];
+	dst[len] = '\0';
+	return len;
+}
+
+/* As TGMK() */
+static inline int fmt_tgmk(char *dst, uint64_t v)
+{
+	static const char unit[4][3] = { "Ti ", "Gi ", "Mi ", "Ki " };
+	char *p = dst;
+	int i;
+
+	p += fmt_u64(p, v >> 40);
+	for (i = 0; i < 4; i++) {
+		memcpy(p, unit[i], 3);
+		p += 3;
+		p += fmt_u64(p, (v >> (30 - 10 * i)) & 1023);
+	}
+	return p - dst;
+}
+
+static inline size_t fmt_ipv4_batch(char *dst, const uint32_t *ip,
+				    size_t nr, char sep)
+{
+	char *p = dst;
+	size_t i;
+
+	*p = '\0';
+	for (i = 0; i < nr; i++) {
+		if (i)
+			*p++ = sep;
+		p += fmt_ipv4(p, ip[i]);
+	}
+	return p - dst;
+}
+
+static inline size_t fmt_ipv6_batch(char *dst, const uint8_t (*ip)[16],
+				    size_t nr, char sep)
+{
+	char *p = dst;
+	size_t i;
+
+	*p = '\0';
+	for (i = 0; i < nr; i++) {
+		if (i)
+			*p++ = sep;
+		p += fmt_ipv6(p, ip[i]);
+	}
+	return p - dst;
+}
+
+static inline size_t fmt_mac_batch(char *dst, const uint8_t (*mac)[6],
+				   size_t nr, char sep)
+{
+	char *p = dst;
+	size_t i;
+
+	*p = '\0';
+	for (i = 0; i < nr; i++) {
+		if (i)
+			*p++ = sep;
+		p += fmt_mac(p, mac[i]);
+	}
+	return p - dst;
+}
+
+static inline size_t fmt_u64_batch(char *dst, const uint64_t *v,
+				   size_t nr, char sep)
+{
+	char *p = dst;
+	size_t i;
+
+	*p = '\0';
+	for (i = 0; i < nr; i++) {
+		if (i)
+			*p++ = sep;
+		p += fmt_u64(p, v[i]);
+	}
+	return p - dst;
+}
+
+static inline size_t fmt_x64_batch(char *dst, const uint64_t *v,
+				   size_t nr, char sep)
+{
+	char *p = dst;
+	size_t i;
+
+	*p = '\0';
+	for (i = 0; i < nr; i++) {
+		if (i)
+			*p++ = sep;
+		p += fmt_x64(p, v[i]);
+	}
+	return p - dst;
+}
+
+#endif	/* __FORMAT_H */
@@ -0,0 +1,84 @@
+#ifndef __LPM4_H
+#define __LPM4_H
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * IPv4 longest prefix match, DIR-24-8, lib/lpm4.c
+ *
+ * tbl24 has one entry per /24: the next hop of the longest prefix of at
+ * most 24 bits covering it, or for the /24s holding longer prefixes the
+ * index of a tbl8 group, 256 entries resolving the last byte. A lookup is
+ * one memory access, two past a /24.
+ *
+ * Every entry keeps the depth of the prefix it comes from, so a prefix is
+ * added or deleted in place without rebuilding: an entry is only written
+ * over by a prefix at least as long. The rules themselves are kept aside
+ * to find what a deleted prefix uncovers.
+ *
+ * Updates are serialized by the caller, against lookups too.
+ */
+
+#define LPM4_VALID		0x80000000U
+#define LPM4_EXT		0x40000000U	/* tbl24 entry, a tbl8 group */
+#define LPM4_DEPTH_SHIFT	24
+#define LPM4_DEPTH_MASK		0x3fU
+#define LPM4_NH_MASK		0x00ffffffU
+
+#define LPM4_NH_MAX		LPM4_NH_MASK
+#define LPM4_NONE		0xffffffffU	/* no prefix covers the address */
+
+#define LPM4_TBL24_SIZE		(1U << 24)
+#define LPM4_TBL8_SIZE		256
+#define LPM4_GROUPS		256		/* tbl8 groups by default */
+
+/* How far ahead lpm4_lookup_bulk() prefetches */
+#define LPM4_PREFETCH		16
+
+struct lpm4_rule
+{
+	uint32_t prefix;	/* host order */
+	uint8_t depth;
+	uint32_t nh;
+};
+
+struct lpm4_rules;
+
+struct lpm4
+{
+	uint32_t *tbl24;
+	uint32_t *tbl8;		/* groups * LPM4_TBL8_SIZE */
+	uint32_t groups;
+	uint32_t nr_free;
+	uint32_t *free;		/* stack of the free groups */
+	struct lpm4_rules *rules;
+};
+
+struct lpm4 *lpm4_create(uint32_t groups);
+void lpm4_free(struct lpm4 *t);
+int lpm4_add(struct lpm4 *t, uint32_t prefix, uint8_t depth, uint32_t nh);
+int lpm4_delete(struct lpm4 *t, uint32_t prefix, uint8_t depth);
+int lpm4_build(struct lpm4 *t, const struct lpm4_rule *rules, uint32_t nr);
+uint32_t lpm4_rules(const struct lpm4 *t);
+int lpm4_parse(const char *str, uint32_t *prefix, uint8_t *depth);
+void lpm4_lookup_bulk(const struct lpm4 *t, const uint32_t *ip,
+		      uint32_t *nh, uint32_t nr);
+
+/* Next hop of the longest prefix covering ip, host order, or LPM4_NONE */
+static inline uint32_t lpm4_lookup(const struct lpm4 *t, uint32_t ip)
+{
+	uint32_t e = t->tbl24[ip >> 8];
+
+	if (e & LPM4_EXT)
+		e = t->tbl8[(e & LPM4_NH_MASK) * LPM4_TBL8_SIZE + (ip & 0xff)];
+	return e & LPM4_VALID ? e & LPM4_NH_MASK : LPM4_NONE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __LPM4_H */
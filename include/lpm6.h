@@ -0,0 +1,100 @@
+#ifndef __LPM6_H
+#define __LPM6_H
+#include "common.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * IPv6 longest prefix match, a Poptrie, lib/lpm6.c
+ *
+ * A multibit trie of 6 bit strides, every node compressed into two 64 bit
+ * vectors: vector has a bit per chunk value going to a child, leafvec a
+ * bit where a run of equal leaves starts. The children of a node, and its
+ * leaves, are contiguous: the popcount of a vector up to the chunk is the
+ * offset from the node's base. A lookup reads one 24 byte node per 6 bits
+ * of the prefixes on its path, then one leaf.
+ *
+ * The trie is built once from a rule set and only read afterwards, by any
+ * number of threads; a changed set is built aside and swapped in.
+ */
+
+#define LPM6_STRIDE		6
+#define LPM6_NONE		0xffffffffU	/* no prefix covers the address */
+
+/* Lookups walked side by side by lpm6_lookup_bulk() */
+#define LPM6_BATCH		8
+
+struct lpm6_rule
+{
+	uint8_t prefix[16];	/* network order */
+	uint8_t depth;
+	uint32_t nh;
+};
+
+struct lpm6_node
+{
+	uint64_t vector;	/* chunk values with a child, MSB first */
+	uint64_t leafvec;	/* first chunk value of every leaf run */
+	uint32_t base0;		/* first leaf */
+	uint32_t base1;		/* first child */
+};
+
+struct lpm6
+{
+	struct lpm6_node *nodes;	/* the root first */
+	uint32_t *leaves;
+	uint32_t nr_nodes;
+	uint32_t nr_leaves;
+};
+
+struct lpm6 *lpm6_build(const struct lpm6_rule *rules, uint32_t nr);
+void lpm6_free(struct lpm6 *t);
+int lpm6_parse(const char *str, uint8_t *prefix, uint8_t *depth);
+void lpm6_lookup_bulk(const struct lpm6 *t, const uint8_t (*ip)[16],
+		      uint32_t *nh, uint32_t nr);
+
+/* The 6 bits at off of the address, hi and lo its halves in host order */
+static inline uint32_t lpm6_chunk(uint64_t hi, uint64_t lo, uint32_t off)
+{
+	if (off <= 64 - LPM6_STRIDE)
+		return (hi >> (64 - LPM6_STRIDE - off)) & 63;
+	if (off < 64)
+		return ((hi << (off - (64 - LPM6_STRIDE))) |
+			(lo >> (128 - LPM6_STRIDE - off))) & 63;
+	if (off <= 128 - LPM6_STRIDE)
+		return (lo >> (128 - LPM6_STRIDE - off)) & 63;
+	/* Past the last bit, zeros */
+	return (lo << (off - (128 - LPM6_STRIDE))) & 63;
+}
+
+/* Vector bits of the chunk values up to c */
+static inline uint64_t lpm6_upto(uint32_t c)
+{
+	return ~0ULL << (63 - c);
+}
+
+/* Next hop of the longest prefix covering the 16 bytes of ip, or LPM6_NONE */
+static inline uint32_t lpm6_lookup(const struct lpm6 *t, const uint8_t *ip)
+{
+	uint64_t hi = load_be64(ip), lo = load_be64(ip + 8);
+	const struct lpm6_node *n = t->nodes;
+	uint32_t off = 0, c;
+
+	for (;;) {
+		c = lpm6_chunk(hi, lo, off);
+		if (!(n->vector >> (63 - c) & 1))
+			break;
+		n = t->nodes + n->base1 + popcnt64(n->vector & lpm6_upto(c)) -
+		    1;
+		off += LPM6_STRIDE;
+	}
+	return t->leaves[n->base0 + popcnt64(n->leafvec & lpm6_upto(c)) - 1];
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __LPM6_H */
@@ -0,0 +1,198 @@
+#ifndef __TS_BM_H
+#define __TS_BM_H
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Boyer-Moore text search, lib/ts_bm.c
+ *
+ * A pattern is compiled once into a struct ts_bm, which is never written
+ * again: any number of threads may search with the same one. The object
+ * is one block, tables and pattern included, bm_size() bytes long, so a
+ * table of patterns can be packed into a single buffer with bm_init_buf().
+ */
+
+#define TS_BM_ASIZE		256
+
+/*
+ * From TS_BM_QGRAM2 bytes on, bm_find() shifts on the hash of the last 2
+ * bytes of the window (3 from TS_BM_QGRAM3) rather than on the last byte:
+ * long patterns have most byte values, not most q-grams.
+ */
+#define TS_BM_QGRAM2		32
+#define TS_BM_QGRAM3		128
+#define TS_BM_QBITS		12
+#define TS_BM_QSIZE		(1 << TS_BM_QBITS)
+#define TS_BM_QHASH(g)		(((uint32_t)(g) * 0x9E3779B1U) >> \
+				 (32 - TS_BM_QBITS))
+
+/* bm_init() flags */
+#define TS_IGNORECASE		0x1
+
+/* bm_find_all() flags: go on after a match from the pattern period */
+#ifndef BM_OVERLAP
+#define BM_OVERLAP		0x1
+#endif
+
+struct ts_bm
+{
+	uint32_t patlen;
+	uint32_t match_shift;	/* smallest period of the pattern */
+	uint32_t flags;
+	uint32_t size;		/* of the whole object */
+	uint32_t q;		/* q-gram length, 0 for single bytes */
+	uint32_t qmatch_shift;	/* after a candidate of the q-gram table */
+	uint32_t bad_shift[TS_BM_ASIZE];
+	/* patlen entries, then the pattern, then the q-gram table if any */
+	uint32_t good_shift[0];
+};
+
+/* ASCII case folding */
+extern const uint8_t ts_bm_fold[TS_BM_ASIZE];
+
+static inline const uint8_t *bm_pattern(const struct ts_bm *bm)
+{
+	return (const uint8_t *)(bm->good_shift + bm->patlen);
+}
+
+static inline uint32_t bm_qgram(uint32_t len)
+{
+	return len < TS_BM_QGRAM2 ? 0 : len < TS_BM_QGRAM3 ? 2 : 3;
+}
+
+/* TS_BM_QSIZE shifts by TS_BM_QHASH() of the q-gram ending the window */
+static inline const uint16_t *bm_qshift(const struct ts_bm *bm)
+{
+	return (const uint16_t *)((const uint8_t *)bm +
+		((sizeof(*bm) + bm->patlen * 5 + 3) & ~3));
+}
+
+/* Next object of a buffer packed with bm_init_buf() */
+static inline const struct ts_bm *bm_packed_next(const struct ts_bm *bm)
+{
+	return (const struct ts_bm *)((const uint8_t *)bm + bm->size);
+}
+
+size_t bm_size(uint32_t len);
+struct ts_bm *bm_init_buf(void *buf, const void *pattern, uint32_t len,
+			  int flags);
+struct ts_bm *bm_init(const void *pattern, uint32_t len, int flags);
+void bm_free(struct ts_bm *bm);
+
+/* A pattern of a set compiled at once, lib/ts_bm_batch.c */
+struct ts_bm_src
+{
+	const void *pattern;
+	uint32_t len;
+	int flags;
+	struct ts_bm *bm;	/* set by bm_init_batch() */
+};
+
+size_t bm_batch_size(const struct ts_bm_src *src, uint32_t nr);
+int bm_init_batch(void *buf, struct ts_bm_src *src, uint32_t nr,
+		  int threads);
+
+uint8_t *bm_find(const struct ts_bm *bm, const uint8_t *text,
+		 uint32_t text_len);
+uint32_t bm_find_all(const struct ts_bm *bm, const uint8_t *text,
+		     uint32_t text_len, int flags,
+		     int (*match)(uint32_t off, void *arg), void *arg);
+uint32_t bm_count(const struct ts_bm *bm, const uint8_t *text,
+		  uint32_t text_len, int flags);
+uint32_t bm_find_offs(const struct ts_bm *bm, const uint8_t *text,
+		      uint32_t text_len, int flags, uint32_t *offs,
+		      uint32_t max);
+
+/* Per reader state of a stream search, the pattern stays shared */
+struct ts_bm_stream
+{
+	const struct ts_bm *bm;
+	uint64_t offset;	/* stream offset of the next chunk */
+	uint32_t held;		/* stream bytes kept in buf */
+	uint8_t buf[0];		/* held tail + head of the next chunk */
+};
+
+struct ts_bm_stream *bm_stream_init(const struct ts_bm *bm);
+void bm_stream_free(struct ts_bm_stream *ctx);
+int64_t bm_find_stream(struct ts_bm_stream *ctx, const uint8_t *chunk,
+		       uint32_t len);
+
+void bm_qgram_shift(const uint8_t *pattern, uint32_t len, uint32_t q,
+		    uint16_t *shift, uint32_t *match_shift);
+
+int bm_parse_escape(const char *src, uint8_t *dst);
+uint32_t bm_parse_pattern(const char *src, uint8_t *dst, int flags);
+void bm_dump(const struct ts_bm *bm, FILE *f);
+
+/*
+ * Search counters, lib/ts_bm_stats.c
+ *
+ * Built with -DTS_BM_STATS, the library and the code including bm_build
+ * headers alike, bm_find() and the generated bm_find_<pattern>() count
+ * their work per pattern in counters of the calling thread, and
+ * bm_stats_dump() sums the threads up. Without it the TS_BM_STAT*() hooks
+ * are empty and the kernels are the same as ever.
+ *
+ * A window is one alignment of the pattern tried, a SIMD block for the
+ * generated filter. Candidates are the windows passing the early checks
+ * (the last byte for BM, the q-gram for hashq, the first and last bytes
+ * for SIMD), which are compared further.
+ */
+#ifdef TS_BM_STATS
+struct ts_bm_stats
+{
+	const void *key;	/* struct ts_bm or generated pattern */
+	char name[33];		/* as dumped */
+	uint32_t patlen;
+	uint64_t bytes;		/* text scanned */
+	uint64_t windows;
+	uint64_t compares;	/* text bytes against pattern bytes */
+	uint64_t shifts;
+	uint64_t shift_sum;
+	uint64_t shift_max;
+	uint64_t verified;	/* candidates */
+	uint64_t matches;
+};
+
+struct ts_bm_stats *bm_stats_get(const void *key, const char *name,
+				 uint32_t patlen);
+void bm_stats_reset(void);
+void bm_stats_dump(FILE *f);
+
+static inline void bm_stats_shift(struct ts_bm_stats *st, uint32_t shift)
+{
+	st->shifts++;
+	st->shift_sum += shift;
+	if (shift > st->shift_max)
+		st->shift_max = shift;
+}
+
+/* Text from start to end scanned, ending on a match if found */
+static inline void bm_stats_scan(struct ts_bm_stats *st, int64_t start,
+				 int64_t end, int found)
+{
+	if (end > start)
+		st->bytes += end - start;
+	st->matches += found;
+}
+
+#define TS_BM_STAT(st, f, v)		((void)((st)->f += (v)))
+#define TS_BM_STAT_SHIFT(st, v)		bm_stats_shift(st, v)
+#define TS_BM_STAT_RET(st, start, end, p) \
+	(bm_stats_scan(st, start, end, (p) != NULL), (p))
+#elif !defined(TS_BM_STAT)
+#define TS_BM_STAT(st, f, v)		((void)0)
+#define TS_BM_STAT_SHIFT(st, v)		((void)0)
+#define TS_BM_STAT_RET(st, start, end, p)	(p)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __TS_BM_H */
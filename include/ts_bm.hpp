@@ -0,0 +1,210 @@
+#ifndef __TS_BM_HPP
+#define __TS_BM_HPP
+#if __cplusplus < 202002L
+#error "ts_bm.hpp needs C++20 (string literal template arguments)"
+#endif
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <type_traits>
+
+/*
+ * Boyer-Moore with the tables built by the compiler, the pattern being a
+ * template argument:
+ *
+ *	using host = ts::bm_matcher<"Host:", ts::icase>;
+ *	const uint8_t *p = host::find(text, len);
+ *
+ * Same tables as bm_init() of lib/ts_bm.c, read-only data without any
+ * startup cost, and the search loop specialized for the pattern as the
+ * bm_build output, without the build step.
+ */
+
+namespace ts {
+
+/* bm_matcher flags */
+enum : unsigned {
+	icase	= 0x1,
+};
+
+template <std::size_t N>
+struct fixed_string
+{
+	char str[N];
+
+	constexpr fixed_string(const char (&s)[N])
+	{
+		for (std::size_t i = 0; i < N; i++)
+			str[i] = s[i];
+	}
+
+	/* Without the terminating NUL */
+	static constexpr std::size_t size = N - 1;
+};
+
+constexpr uint8_t bm_fold(uint8_t c)
+{
+	return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+template <fixed_string P, unsigned Flags = 0>
+class bm_matcher
+{
+	static_assert(P.size > 0, "empty pattern");
+
+public:
+	static constexpr uint32_t patlen = P.size;
+
+private:
+	/* Smallest type for shifts up to patlen */
+	using shift_t = std::conditional_t<(patlen < 0x100), uint8_t,
+		std::conditional_t<(patlen < 0x10000), uint16_t, uint32_t>>;
+
+	struct tables
+	{
+		uint8_t pattern[patlen];
+		shift_t bad_shift[256];
+		shift_t good_shift[patlen];
+		uint32_t match_shift;
+	};
+
+	/* compute_suffixes() of lib/ts_bm.c */
+	static constexpr void compute_suffixes(const uint8_t *x, int *suff)
+	{
+		int m = patlen, f = m - 1, g = m - 1, i;
+
+		suff[m - 1] = m;
+		for (i = m - 2; i >= 0; i--) {
+			if (i > g && suff[i + m - 1 - f] < i - g) {
+				suff[i] = suff[i + m - 1 - f];
+			} else {
+				if (i < g)
+					g = i;
+				f = i;
+				while (g >= 0 && x[g] == x[g + m - 1 - f])
+					g--;
+				suff[i] = f - g;
+			}
+		}
+	}
+
+	/* compute_prefix_tbl() of lib/ts_bm.c */
+	static constexpr tables compute_prefix_tbl()
+	{
+		tables t{};
+		int suff[patlen]{};
+		int m = patlen, i, j;
+
+		for (i = 0; i < m; i++) {
+			t.pattern[i] = P.str[i];
+			if (Flags & icase)
+				t.pattern[i] = bm_fold(t.pattern[i]);
+		}
+
+		for (i = 0; i < 256; i++)
+			t.bad_shift[i] = m;
+		for (i = 0; i < m - 1; i++) {
+			t.bad_shift[t.pattern[i]] = m - 1 - i;
+			if ((Flags & icase) && t.pattern[i] >= 'a' &&
+			    t.pattern[i] <= 'z')
+				t.bad_shift[t.pattern[i] - ('a' - 'A')] =
+					m - 1 - i;
+		}
+
+		compute_suffixes(t.pattern, suff);
+		for (i = 0; i < m; i++)
+			t.good_shift[i] = m;
+		for (i = m - 1, j = 0; i >= 0; i--)
+			if (suff[i] == i + 1)
+				for (; j < m - 1 - i; j++)
+					if (t.good_shift[m - 1 - j] == m)
+						t.good_shift[m - 1 - j] =
+							m - 1 - i;
+		for (i = 0; i <= m - 2; i++)
+			t.good_shift[suff[i]] = m - 1 - i;
+
+		for (i = m - 2; i >= 0; i--)
+			if (suff[i] == i + 1)
+				break;
+		t.match_shift = m - 1 - i;
+		return t;
+	}
+
+	static constexpr tables tbl = compute_prefix_tbl();
+
+	static constexpr uint8_t text_at(const uint8_t *text, std::size_t i)
+	{
+		return Flags & icase ? bm_fold(text[i]) : text[i];
+	}
+
+	/* Galil rule: the first known bytes of the window already match */
+	static const uint8_t *scan(const uint8_t *text, std::size_t len,
+				   std::size_t shift, std::size_t known = 0)
+	{
+		std::size_t i, bs, gs, n = patlen - known;
+
+		while (shift < len) {
+			for (i = 0; i < n; i++)
+				if (text_at(text, shift - i) !=
+				    tbl.pattern[patlen - 1 - i])
+					goto next;
+			return text + shift - (patlen - 1);
+next:
+			n = patlen;
+			bs = shift - i + tbl.bad_shift[text[shift - i]];
+			gs = shift + tbl.good_shift[i];
+			shift = bs > gs ? bs : gs;
+		}
+		return nullptr;
+	}
+
+public:
+	static const uint8_t *find(const uint8_t *text, std::size_t len)
+	{
+		return scan(text, len, patlen - 1);
+	}
+
+	/* Offset of the first match, std::string_view::npos if none */
+	static std::size_t find(std::string_view text)
+	{
+		auto base = reinterpret_cast<const uint8_t *>(text.data());
+		auto p = find(base, text.size());
+
+		return p ? p - base : std::string_view::npos;
+	}
+
+	/* Matches, overlapping ones too with overlap, as bm_count() */
+	static std::size_t count(const uint8_t *text, std::size_t len,
+				 bool overlap = false)
+	{
+		std::size_t nr = 0, shift = patlen - 1, known = 0;
+		const uint8_t *p;
+
+		while ((p = scan(text, len, shift, known))) {
+			nr++;
+			shift = p - text + patlen - 1 +
+				(overlap ? tbl.match_shift : patlen);
+			known = overlap ? patlen - tbl.match_shift : 0;
+		}
+		return nr;
+	}
+
+	static constexpr uint32_t bad_shift(uint8_t c)
+	{
+		return tbl.bad_shift[c];
+	}
+
+	static constexpr uint32_t good_shift(uint32_t i)
+	{
+		return tbl.good_shift[i];
+	}
+
+	static constexpr uint32_t match_shift()
+	{
+		return tbl.match_shift;
+	}
+};
+
+}	/* namespace ts */
+
+#endif	/* __TS_BM_HPP */
@@ -0,0 +1,44 @@
+#ifndef __TS_BM_JIT_H
+#define __TS_BM_JIT_H
+#include "ts_bm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * x86-64 machine code for one compiled pattern, lib/ts_bm_jit.c
+ *
+ * find has the signature of the bm_find_<pattern>() of bm_build, it is
+ * NULL when no code could be emitted (other arch, pattern too long, no
+ * executable mapping): bm_jit_find() then goes to bm_find().
+ */
+
+#define TS_BM_JIT_MAX		256
+
+typedef uint8_t *(*bm_jit_fn)(const uint8_t *text, uint32_t len);
+
+struct ts_bm_jit
+{
+	bm_jit_fn find;
+	const struct ts_bm *bm;
+	void *code;
+	size_t size;
+};
+
+struct ts_bm_jit *bm_jit(const struct ts_bm *bm);
+void bm_jit_free(struct ts_bm_jit *jit);
+
+static inline uint8_t *bm_jit_find(const struct ts_bm_jit *jit,
+				   const uint8_t *text, uint32_t len)
+{
+	if (jit->find)
+		return jit->find(text, len);
+	return bm_find(jit->bm, text, len);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __TS_BM_JIT_H */
@@ -0,0 +1,48 @@
+#ifndef __TS_TEDDY_H
+#define __TS_TEDDY_H
+#include "ts_bm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Teddy, a few short literals at once, lib/ts_teddy.c
+ *
+ * Patterns use the bm_parse_pattern() syntax, TS_IGNORECASE applies to all
+ * of them. teddy_find() returns the first match in the text, the pattern
+ * with the lowest id when several start there. As struct ts_bm the object
+ * is read-only once built.
+ */
+
+#define TS_TEDDY_MAX		32	/* patterns */
+#define TS_TEDDY_MAXLEN		32	/* bytes of one pattern */
+#define TS_TEDDY_BUCKETS	8
+#define TS_TEDDY_MASKS		3	/* leading bytes filtered */
+
+struct ts_teddy
+{
+	uint32_t nr;
+	uint32_t nmask;		/* leading bytes in the masks */
+	uint32_t flags;
+	/* Per leading byte and nibble value, the buckets having it */
+	uint8_t lo[TS_TEDDY_MASKS][16];
+	uint8_t hi[TS_TEDDY_MASKS][16];
+	/* Pattern ids per bucket, ascending */
+	uint8_t bucket_nr[TS_TEDDY_BUCKETS];
+	uint8_t bucket[TS_TEDDY_BUCKETS][TS_TEDDY_MAX];
+	uint8_t len[TS_TEDDY_MAX];
+	uint8_t pattern[TS_TEDDY_MAX][TS_TEDDY_MAXLEN];
+};
+
+struct ts_teddy *teddy_init(const char *const *patterns, uint32_t nr,
+			    int flags);
+void teddy_free(struct ts_teddy *t);
+uint8_t *teddy_find(const struct ts_teddy *t, const uint8_t *text,
+		    uint32_t len, uint32_t *id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif	/* __TS_TEDDY_H */
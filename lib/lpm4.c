@@ -0,0 +1,416 @@
+/*
+ * lib/lpm4.c		IPv4 longest prefix match, DIR-24-8
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   [1] Routing Lookups in Hardware at Memory Access Speeds, P. Gupta,
+ *       S. Lin and N. McKeown. IEEE INFOCOM 1998, pp. 1240-1247.
+ *
+ *   An entry is VALID | depth << 24 | next hop, or in tbl24 EXT | group.
+ *   Adding a prefix writes the entries of its range holding a prefix of
+ *   at most its depth; deleting one writes the entries holding its own
+ *   depth back to the longest rule covering it, looked up in the rule
+ *   hash one depth at a time. A group left holding a single entry of at
+ *   most 24 bits goes back to tbl24.
+ *
+ *   Bulk lookups prefetch the tbl24 entry LPM4_PREFETCH addresses ahead,
+ *   so that many misses are in flight at once. Prefetching the tbl8 entries
+ *   as well, or resolving bursts in stages, measured slower: few lookups
+ *   go past a /24, and the extra passes cost more than those misses.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "common.h"
+#include "lpm4.h"
+
+#define LPM4_RULE_EMPTY		0xff	/* depth of a free rule slot */
+
+/* Open addressed by prefix and depth, linear probing */
+struct lpm4_rules
+{
+	uint32_t bits;
+	uint32_t nr;
+	struct lpm4_rule slot[0];
+};
+
+static inline uint32_t lpm4_mask(uint8_t depth)
+{
+	return depth ? ~0U << (32 - depth) : 0;
+}
+
+static inline uint32_t lpm4_entry(uint8_t depth, uint32_t nh)
+{
+	return LPM4_VALID | (uint32_t)depth << LPM4_DEPTH_SHIFT | nh;
+}
+
+static inline uint8_t lpm4_depth(uint32_t e)
+{
+	return (e >> LPM4_DEPTH_SHIFT) & LPM4_DEPTH_MASK;
+}
+
+static inline uint32_t *lpm4_group(const struct lpm4 *t, uint32_t e)
+{
+	return t->tbl8 + (e & LPM4_NH_MASK) * LPM4_TBL8_SIZE;
+}
+
+static struct lpm4_rules *lpm4_rules_alloc(uint32_t bits)
+{
+	struct lpm4_rules *r;
+	uint32_t i;
+
+	r = malloc(sizeof(*r) + (sizeof(r->slot[0]) << bits));
+	if (r == NULL)
+		return NULL;
+	r->bits = bits;
+	r->nr = 0;
+	for (i = 0; i < 1U << bits; i++)
+		r->slot[i].depth = LPM4_RULE_EMPTY;
+	return r;
+}
+
+static inline uint32_t lpm4_rules_hash(const struct lpm4_rules *r,
+				       uint32_t prefix, uint8_t depth)
+{
+	return ((prefix | (uint64_t)depth << 32) * 0x9E3779B97F4A7C15ULL) >>
+	       (64 - r->bits);
+}
+
+static struct lpm4_rule *lpm4_rules_find(const struct lpm4_rules *r,
+					 uint32_t prefix, uint8_t depth)
+{
+	uint32_t mask = (1U << r->bits) - 1, i;
+	const struct lpm4_rule *s;
+
+	for (i = lpm4_rules_hash(r, prefix, depth);; i = (i + 1) & mask) {
+		s = &r->slot[i];
+		if (s->depth == LPM4_RULE_EMPTY)
+			return NULL;
+		if (s->prefix == prefix && s->depth == depth)
+			return (struct lpm4_rule *)s;
+	}
+}
+
+/* A new slot, the table has room */
+static struct lpm4_rule *lpm4_rules_put(struct lpm4_rules *r, uint32_t prefix,
+					uint8_t depth)
+{
+	uint32_t mask = (1U << r->bits) - 1, i;
+	struct lpm4_rule *s;
+
+	for (i = lpm4_rules_hash(r, prefix, depth);
+	     r->slot[i].depth != LPM4_RULE_EMPTY; i = (i + 1) & mask)
+		;
+	s = &r->slot[i];
+	s->prefix = prefix;
+	s->depth = depth;
+	r->nr++;
+	return s;
+}
+
+/* The slot of prefix/depth, a new one if needed, NULL out of memory */
+static struct lpm4_rule *lpm4_rules_get(struct lpm4 *t, uint32_t prefix,
+					uint8_t depth)
+{
+	struct lpm4_rules *r = t->rules, *n;
+	struct lpm4_rule *s;
+	uint32_t i;
+
+	s = lpm4_rules_find(r, prefix, depth);
+	if (s)
+		return s;
+	/* Half full at most */
+	if ((r->nr + 1) * 2 > 1U << r->bits) {
+		n = lpm4_rules_alloc(r->bits + 1);
+		if (n == NULL)
+			return NULL;
+		for (i = 0; i < 1U << r->bits; i++) {
+			if (r->slot[i].depth == LPM4_RULE_EMPTY)
+				continue;
+			s = lpm4_rules_put(n, r->slot[i].prefix,
+					   r->slot[i].depth);
+			s->nh = r->slot[i].nh;
+		}
+		free(r);
+		t->rules = r = n;
+	}
+	return lpm4_rules_put(r, prefix, depth);
+}
+
+/* Backward shift: the probe chains running through s stay unbroken */
+static void lpm4_rules_remove(struct lpm4_rules *r, struct lpm4_rule *s)
+{
+	uint32_t mask = (1U << r->bits) - 1, i, j, h;
+
+	i = s - r->slot;
+	for (j = (i + 1) & mask; r->slot[j].depth != LPM4_RULE_EMPTY;
+	     j = (j + 1) & mask) {
+		h = lpm4_rules_hash(r, r->slot[j].prefix, r->slot[j].depth);
+		/* j may move to i if its home isn't in (i, j] */
+		if (((j - h) & mask) >= ((j - i) & mask)) {
+			r->slot[i] = r->slot[j];
+			i = j;
+		}
+	}
+	r->slot[i].depth = LPM4_RULE_EMPTY;
+	r->nr--;
+}
+
+/*
+ * groups tbl8 groups of 256 entries, LPM4_GROUPS if 0: one is taken by
+ * every /24 holding a prefix longer than 24 bits. NULL with errno set on
+ * failure.
+ */
+struct lpm4 *lpm4_create(uint32_t groups)
+{
+	struct lpm4 *t;
+	uint32_t i;
+
+	if (groups == 0)
+		groups = LPM4_GROUPS;
+	if (groups > LPM4_NH_MAX + 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->groups = groups;
+	t->tbl24 = calloc(LPM4_TBL24_SIZE, sizeof(*t->tbl24));
+	t->tbl8 = calloc((size_t)groups * LPM4_TBL8_SIZE, sizeof(*t->tbl8));
+	t->free = malloc(groups * sizeof(*t->free));
+	t->rules = lpm4_rules_alloc(6);
+	if (t->tbl24 == NULL || t->tbl8 == NULL || t->free == NULL ||
+	    t->rules == NULL) {
+		lpm4_free(t);
+		errno = ENOMEM;
+		return NULL;
+	}
+	/* Group 0 first */
+	for (i = 0; i < groups; i++)
+		t->free[i] = groups - 1 - i;
+	t->nr_free = groups;
+	return t;
+}
+
+void lpm4_free(struct lpm4 *t)
+{
+	if (t == NULL)
+		return;
+	free(t->tbl24);
+	free(t->tbl8);
+	free(t->free);
+	free(t->rules);
+	free(t);
+}
+
+uint32_t lpm4_rules(const struct lpm4 *t)
+{
+	return t->rules->nr;
+}
+
+/* Entries holding a prefix of at most depth bits, or none, become v */
+static void lpm4_cover(uint32_t *e, uint32_t nr, uint8_t depth, uint32_t v)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		if (!(e[i] & LPM4_VALID) || lpm4_depth(e[i]) <= depth)
+			e[i] = v;
+}
+
+/* Entries holding a prefix of depth bits become v */
+static void lpm4_uncover(uint32_t *e, uint32_t nr, uint8_t depth, uint32_t v)
+{
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		if ((e[i] & LPM4_VALID) && lpm4_depth(e[i]) == depth)
+			e[i] = v;
+}
+
+/* Over the /24s of a prefix of at most 24 bits, their groups included */
+static void lpm4_write24(struct lpm4 *t, uint32_t prefix, uint8_t depth,
+			 uint32_t v,
+			 void (*write)(uint32_t *, uint32_t, uint8_t, uint32_t))
+{
+	uint32_t i, end = (prefix >> 8) + (1U << (24 - depth));
+
+	for (i = prefix >> 8; i < end; i++) {
+		if (t->tbl24[i] & LPM4_EXT)
+			write(lpm4_group(t, t->tbl24[i]), LPM4_TBL8_SIZE,
+			      depth, v);
+		else
+			write(&t->tbl24[i], 1, depth, v);
+	}
+}
+
+/*
+ * Adds prefix/depth with next hop nh, or changes the next hop of a prefix
+ * already there. The bits of prefix past depth are ignored. Returns 0,
+ * else -1 with errno set: EINVAL, ENOMEM, or ENOSPC out of tbl8 groups,
+ * the table unchanged.
+ */
+int lpm4_add(struct lpm4 *t, uint32_t prefix, uint8_t depth, uint32_t nh)
+{
+	struct lpm4_rule *s;
+	uint32_t idx, e, *g;
+
+	if (depth > 32 || nh > LPM4_NH_MAX) {
+		errno = EINVAL;
+		return -1;
+	}
+	prefix &= lpm4_mask(depth);
+	idx = prefix >> 8;
+	if (depth > 24 && !(t->tbl24[idx] & LPM4_EXT) && t->nr_free == 0) {
+		errno = ENOSPC;
+		return -1;
+	}
+	s = lpm4_rules_get(t, prefix, depth);
+	if (s == NULL) {
+		errno = ENOMEM;
+		return -1;
+	}
+	s->nh = nh;
+
+	if (depth <= 24) {
+		lpm4_write24(t, prefix, depth, lpm4_entry(depth, nh),
+			     lpm4_cover);
+		return 0;
+	}
+	e = t->tbl24[idx];
+	if (!(e & LPM4_EXT)) {
+		/* The group starts as the /24 it replaces */
+		g = t->tbl8 + t->free[--t->nr_free] * LPM4_TBL8_SIZE;
+		lpm4_cover(g, LPM4_TBL8_SIZE, 32, e);
+		e = LPM4_EXT | (g - t->tbl8) / LPM4_TBL8_SIZE;
+		t->tbl24[idx] = e;
+	}
+	lpm4_cover(lpm4_group(t, e) + (prefix & 0xff), 1U << (32 - depth),
+		   depth, lpm4_entry(depth, nh));
+	return 0;
+}
+
+/*
+ * Deletes prefix/depth: its addresses go back to the longest prefix left
+ * covering them. Returns 0, else -1 with errno set, ENOENT if it isn't
+ * there.
+ */
+int lpm4_delete(struct lpm4 *t, uint32_t prefix, uint8_t depth)
+{
+	struct lpm4_rule *s;
+	uint32_t idx, v = 0, *g, i;
+	int d;
+
+	if (depth > 32) {
+		errno = EINVAL;
+		return -1;
+	}
+	prefix &= lpm4_mask(depth);
+	s = lpm4_rules_find(t->rules, prefix, depth);
+	if (s == NULL) {
+		errno = ENOENT;
+		return -1;
+	}
+	lpm4_rules_remove(t->rules, s);
+	for (d = depth - 1; d >= 0; d--) {
+		s = lpm4_rules_find(t->rules, prefix & lpm4_mask(d), d);
+		if (s) {
+			v = lpm4_entry(d, s->nh);
+			break;
+		}
+	}
+
+	if (depth <= 24) {
+		lpm4_write24(t, prefix, depth, v, lpm4_uncover);
+		return 0;
+	}
+	idx = prefix >> 8;
+	g = lpm4_group(t, t->tbl24[idx]);
+	lpm4_uncover(g + (prefix & 0xff), 1U << (32 - depth), depth, v);
+	/* Nothing longer than 24 bits left, back to tbl24 */
+	if ((g[0] & LPM4_VALID) && lpm4_depth(g[0]) > 24)
+		return 0;
+	for (i = 1; i < LPM4_TBL8_SIZE; i++)
+		if (g[i] != g[0])
+			return 0;
+	t->tbl24[idx] = g[0];
+	t->free[t->nr_free++] = (g - t->tbl8) / LPM4_TBL8_SIZE;
+	return 0;
+}
+
+static int lpm4_rule_cmp(const void *a, const void *b)
+{
+	const struct lpm4_rule *x = a, *y = b;
+
+	return (int)x->depth - (int)y->depth;
+}
+
+/*
+ * Adds nr rules at once. Shortest first, every entry is written once per
+ * prefix covering it instead of being covered again by shorter ones. On
+ * failure, -1 with errno set, the rules before the failing one are in.
+ */
+int lpm4_build(struct lpm4 *t, const struct lpm4_rule *rules, uint32_t nr)
+{
+	struct lpm4_rule *sorted;
+	uint32_t i;
+	int ret = 0;
+
+	sorted = malloc((nr ? nr : 1) * sizeof(*sorted));
+	if (sorted == NULL)
+		return -1;
+	memcpy(sorted, rules, nr * sizeof(*sorted));
+	qsort(sorted, nr, sizeof(*sorted), lpm4_rule_cmp);
+	for (i = 0; i < nr && ret == 0; i++)
+		ret = lpm4_add(t, sorted[i].prefix, sorted[i].depth,
+			       sorted[i].nh);
+	free(sorted);
+	return ret;
+}
+
+/*
+ * "a.b.c.d/len" or "a.b.c.d/m.m.m.m" as str2maskip() takes them, the mask
+ * contiguous. Returns 0, else -1 with errno EINVAL.
+ */
+int lpm4_parse(const char *str, uint32_t *prefix, uint8_t *depth)
+{
+	char buf[64];
+	uint32_t mask = 0, ip;
+	int err;
+
+	if (strlen(str) >= sizeof(buf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	strcpy(buf, str);
+	ip = str2maskip(&mask, buf, &err);
+	if (err || mask != lpm4_mask(popcnt32(mask))) {
+		errno = EINVAL;
+		return -1;
+	}
+	*depth = popcnt32(mask);
+	*prefix = ip & mask;
+	return 0;
+}
+
+/* lpm4_lookup() of the nr addresses of ip into nh */
+void lpm4_lookup_bulk(const struct lpm4 *t, const uint32_t *ip,
+		      uint32_t *nh, uint32_t nr)
+{
+	uint32_t i, e;
+
+	for (i = 0; i < nr; i++) {
+		if (i + LPM4_PREFETCH < nr)
+			__builtin_prefetch(&t->tbl24[ip[i + LPM4_PREFETCH] >> 8]);
+		e = t->tbl24[ip[i] >> 8];
+		if (e & LPM4_EXT)
+			e = lpm4_group(t, e)[ip[i] & 0xff];
+		nh[i] = e & LPM4_VALID ? e & LPM4_NH_MASK : LPM4_NONE;
+	}
+}
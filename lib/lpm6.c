@@ -0,0 +1,290 @@
+/*
+ * lib/lpm6.c		IPv6 longest prefix match, Poptrie
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   [1] Poptrie: A Compressed Trie with Population Count for Fast and
+ *       Scalable Software IP Routing Table Lookup, H. Asai and Y. Ohara.
+ *       ACM SIGCOMM 2015, pp. 57-70.
+ *
+ *   Built top down from the rules sorted by depth: a node gets the rules
+ *   going through it, fills its 64 leaves with those ending within its
+ *   stride, shortest first so that longer ones win, and hands each chunk
+ *   value the rules going further to a child, with the leaf it replaces
+ *   as the default of the child. The children of a node are taken at once
+ *   so they stay contiguous, the walk then goes down into each.
+ *
+ *   Bulk lookups walk LPM6_BATCH addresses a level at a time each, the
+ *   next node of every one prefetched before the first is read, so the
+ *   misses of a batch overlap.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "common.h"
+#include "lpm6.h"
+
+struct lpm6_key
+{
+	uint64_t hi, lo;
+	uint32_t depth;
+	uint32_t nh;
+	uint32_t order;
+};
+
+struct lpm6_builder
+{
+	struct lpm6 *t;
+	uint32_t max_nodes;
+	uint32_t max_leaves;
+};
+
+static int lpm6_key_cmp(const void *a, const void *b)
+{
+	const struct lpm6_key *x = a, *y = b;
+
+	if (x->depth != y->depth)
+		return x->depth < y->depth ? -1 : 1;
+	return x->order < y->order ? -1 : x->order > y->order;
+}
+
+/* nr more entries at the end of an array, their first index or -1 */
+static int64_t lpm6_grow(void **a, uint32_t *nr, uint32_t *max, size_t size,
+			 uint32_t more)
+{
+	uint32_t first = *nr;
+	void *p;
+
+	if ((uint64_t)*nr + more > UINT32_MAX) {
+		errno = ENOSPC;
+		return -1;
+	}
+	if (*nr + more > *max) {
+		*max = max_t(uint32_t, *nr + more, *max * 2);
+		p = realloc(*a, (size_t)*max * size);
+		if (p == NULL)
+			return -1;
+		*a = p;
+	}
+	*nr += more;
+	return first;
+}
+
+/*
+ * Node idx at bit off, from the nr rules of r going through it, sorted
+ * by depth, dflt the leaf of the longest rule ending before it
+ */
+static int lpm6_node_build(struct lpm6_builder *b, uint32_t idx,
+			   struct lpm6_key **r, uint32_t nr, uint32_t off,
+			   uint32_t dflt)
+{
+	uint32_t leaf[64], cnt[64] = { 0 }, first[64], i, c, span, nr_leaf;
+	uint32_t nr_child, prev = 0, k = 0;
+	struct lpm6_key **sub = NULL;
+	struct lpm6_node n = { 0 };
+	int64_t base;
+	int ret = -1;
+
+	for (c = 0; c < 64; c++)
+		leaf[c] = dflt;
+	for (i = 0; i < nr; i++) {
+		c = lpm6_chunk(r[i]->hi, r[i]->lo, off);
+		if (r[i]->depth <= off + LPM6_STRIDE) {
+			span = 1U << (off + LPM6_STRIDE - r[i]->depth);
+			for (c &= ~(span - 1); span--; c++)
+				leaf[c] = r[i]->nh;
+		} else {
+			cnt[c]++;
+		}
+	}
+
+	/* Leaf runs over the chunk values without a child */
+	for (c = 0, nr_child = 0, nr_leaf = 0; c < 64; c++) {
+		if (cnt[c]) {
+			n.vector |= 1ULL << (63 - c);
+			first[c] = k;
+			k += cnt[c];
+			nr_child++;
+		} else if (nr_leaf == 0 || leaf[c] != prev) {
+			n.leafvec |= 1ULL << (63 - c);
+			prev = leaf[c];
+			nr_leaf++;
+		}
+	}
+	base = lpm6_grow((void **)&b->t->leaves, &b->t->nr_leaves,
+			 &b->max_leaves, sizeof(uint32_t), nr_leaf);
+	if (base < 0)
+		return -1;
+	n.base0 = base;
+	for (c = 0, nr_leaf = 0; c < 64; c++)
+		if (n.leafvec >> (63 - c) & 1)
+			b->t->leaves[n.base0 + nr_leaf++] = leaf[c];
+	base = lpm6_grow((void **)&b->t->nodes, &b->t->nr_nodes,
+			 &b->max_nodes, sizeof(struct lpm6_node), nr_child);
+	if (base < 0)
+		return -1;
+	n.base1 = base;
+	b->t->nodes[idx] = n;
+	if (nr_child == 0)
+		return 0;
+
+	/* The rules of every child together, still sorted */
+	sub = malloc(k * sizeof(*sub));
+	if (sub == NULL)
+		return -1;
+	for (i = 0; i < nr; i++) {
+		if (r[i]->depth <= off + LPM6_STRIDE)
+			continue;
+		c = lpm6_chunk(r[i]->hi, r[i]->lo, off);
+		sub[first[c]++] = r[i];
+	}
+	for (c = 0, k = 0, i = 0; c < 64; c++) {
+		if (cnt[c] == 0)
+			continue;
+		if (lpm6_node_build(b, n.base1 + i++, sub + k, cnt[c],
+				    off + LPM6_STRIDE, leaf[c]))
+			goto out;
+		k += cnt[c];
+	}
+	ret = 0;
+out:
+	free(sub);
+	return ret;
+}
+
+/*
+ * Trie of the nr rules, the bits of a prefix past its depth ignored, the
+ * last of the same prefix and depth winning. NULL with errno set on
+ * failure.
+ */
+struct lpm6 *lpm6_build(const struct lpm6_rule *rules, uint32_t nr)
+{
+	struct lpm6_builder b = { .max_nodes = 1 };
+	struct lpm6_key *keys, **r;
+	uint32_t i, dflt = LPM6_NONE;
+	uint64_t mhi, mlo;
+	int err;
+
+	for (i = 0; i < nr; i++) {
+		if (rules[i].depth > 128) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+	b.t = calloc(1, sizeof(*b.t));
+	keys = malloc((nr ? nr : 1) * sizeof(*keys));
+	r = malloc((nr ? nr : 1) * sizeof(*r));
+	if (b.t)
+		b.t->nodes = malloc(sizeof(*b.t->nodes));
+	if (b.t == NULL || b.t->nodes == NULL || keys == NULL || r == NULL)
+		goto fail;
+	b.t->nr_nodes = 1;
+
+	for (i = 0; i < nr; i++) {
+		mhi = rules[i].depth >= 64 ? ~0ULL :
+		      rules[i].depth ? ~0ULL << (64 - rules[i].depth) : 0;
+		mlo = rules[i].depth <= 64 ? 0 :
+		      rules[i].depth >= 128 ? ~0ULL :
+		      ~0ULL << (128 - rules[i].depth);
+		keys[i].hi = load_be64(rules[i].prefix) & mhi;
+		keys[i].lo = load_be64(rules[i].prefix + 8) & mlo;
+		keys[i].depth = rules[i].depth;
+		keys[i].nh = rules[i].nh;
+		keys[i].order = i;
+	}
+	qsort(keys, nr, sizeof(*keys), lpm6_key_cmp);
+	/* The default routes are the root's default leaf */
+	for (i = 0; i < nr && keys[i].depth == 0; i++)
+		dflt = keys[i].nh;
+	nr -= i;
+	memmove(keys, keys + i, nr * sizeof(*keys));
+	for (i = 0; i < nr; i++)
+		r[i] = &keys[i];
+
+	if (lpm6_node_build(&b, 0, r, nr, 0, dflt))
+		goto fail;
+	free(keys);
+	free(r);
+	return b.t;
+fail:
+	err = errno;
+	free(keys);
+	free(r);
+	lpm6_free(b.t);
+	errno = err ? err : ENOMEM;
+	return NULL;
+}
+
+void lpm6_free(struct lpm6 *t)
+{
+	if (t == NULL)
+		return;
+	free(t->nodes);
+	free(t->leaves);
+	free(t);
+}
+
+/*
+ * "address/len" as str2maskip6() takes it. Returns 0, else -1 with errno
+ * EINVAL.
+ */
+int lpm6_parse(const char *str, uint8_t *prefix, uint8_t *depth)
+{
+	char buf[64];
+	int err;
+
+	if (strlen(str) >= sizeof(buf)) {
+		errno = EINVAL;
+		return -1;
+	}
+	strcpy(buf, str);
+	*depth = str2maskip6(prefix, buf, &err);
+	if (err) {
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/* lpm6_lookup() of the nr addresses of ip into nh */
+void lpm6_lookup_bulk(const struct lpm6 *t, const uint8_t (*ip)[16],
+		      uint32_t *nh, uint32_t nr)
+{
+	const struct lpm6_node *n[LPM6_BATCH];
+	uint64_t hi[LPM6_BATCH], lo[LPM6_BATCH];
+	uint32_t i, j, c, off, live, todo;
+
+	for (i = 0; i < nr; i += LPM6_BATCH) {
+		todo = min_t(uint32_t, nr - i, LPM6_BATCH);
+		live = (1U << todo) - 1;
+		for (j = 0; j < todo; j++) {
+			hi[j] = load_be64(ip[i + j]);
+			lo[j] = load_be64(ip[i + j] + 8);
+			n[j] = t->nodes;
+		}
+		/* Every address a level down per round */
+		for (off = 0; live; off += LPM6_STRIDE) {
+			for (j = 0; j < todo; j++) {
+				if (!(live >> j & 1))
+					continue;
+				c = lpm6_chunk(hi[j], lo[j], off);
+				if (n[j]->vector >> (63 - c) & 1) {
+					n[j] = t->nodes + n[j]->base1 +
+					       popcnt64(n[j]->vector &
+							lpm6_upto(c)) - 1;
+					__builtin_prefetch(n[j]);
+					continue;
+				}
+				nh[i + j] = t->leaves[n[j]->base0 +
+					popcnt64(n[j]->leafvec &
+						 lpm6_upto(c)) - 1];
+				live &= ~(1U << j);
+			}
+		}
+	}
+}
@@ -0,0 +1,634 @@
+/*
+ * lib/ts_bm.c		Boyer-Moore text search implementation
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * Authors:	Pablo Neira Ayuso <pablo@eurodev.net>
+ *
+ * ==========================================================================
+ *
+ *   Implements Boyer-Moore string matching algorithm:
+ *
+ *   [1] A Fast String Searching Algorithm, R.S. Boyer and Moore.
+ *       Communications of the Association for Computing Machinery,
+ *       20(10), 1977, pp. 762-772.
+ *       http://www.cs.utexas.edu/users/moore/publications/fstrpos.pdf
+ *
+ *   [2] Handbook of Exact String Matching Algorithms, Thierry Lecroq, 2004
+ *       http://www-igm.univ-mlv.fr/~lecroq/string/string.pdf
+ *
+ *   Note: Since Boyer-Moore (BM) performs searches for matchings from right
+ *   to left, it's still possible that a matching could be spread over
+ *   multiple blocks, in that case this algorithm won't find any coincidence.
+ *
+ *   If you're willing to ensure that such thing won't ever happen, use the
+ *   Knuth-Pratt-Morris (KMP) implementation instead. In conclusion, choose
+ *   the proper string search algorithm depending on your setting.
+ *
+ *   Say you're using the textsearch infrastructure for filtering, NIDS or
+ *   any similar security focused purpose, then go KMP. Otherwise, if you
+ *   really care about performance, say you're classifying packets to apply
+ *   Quality of Service (QoS) policies, and you don't mind about possible
+ *   matchings spread over multiple fragments, then go BM.
+ *
+ *   The stream variant (bm_find_stream()) keeps the last patlen - 1 bytes
+ *   of the previous fragment, so BM also finds the matchings spread over
+ *   them.
+ *
+ *   The worst case is linear in the text, whatever the pattern and the
+ *   text: with the strong good suffix rule BM needs at most 3n compares to
+ *   the first match (Cole), and once a match is found, the window shifted
+ *   by the period of the pattern is only compared up to the bytes already
+ *   known to match (Galil). Without that, "aaa...a" searched for all the
+ *   overlapping matches in "aaaa..." would cost n * m.
+ *
+ *   Compiling a pattern is linear in its length too: the good suffix table
+ *   and the period come from the suffix table of [2], so that signatures
+ *   of several KB load as fast as they are copied. lib/ts_bm_batch.c
+ *   compiles whole sets over threads.
+ *
+ *   Long patterns shift on q-grams instead (HASHq in [5]): the bad shift of
+ *   the last byte of the window is short once the pattern holds most byte
+ *   values, as long binary signatures do, while the shift of its last 2 or
+ *   3 bytes, hashed into TS_BM_QSIZE entries, stays close to m. A window
+ *   is only verified when that shift is 0. Verifications past twice the
+ *   text scanned hand the rest of it to BM, which keeps the linear bound.
+ *
+ *   [3] Tight Bounds on the Complexity of the Boyer-Moore String Matching
+ *       Algorithm, R. Cole. SIAM Journal on Computing, 23(5), 1994.
+ *
+ *   [4] On Improving the Worst Case Running Time of the Boyer-Moore String
+ *       Matching Algorithm, Z. Galil. Communications of the ACM, 22(9),
+ *       1979, pp. 505-508.
+ *
+ *   [5] Fast Exact String Matching Algorithms, T. Lecroq. Information
+ *       Processing Letters, 102(6), 2007, pp. 229-235.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "common.h"
+#include "ts_bm.h"
+
+#define ASIZE TS_BM_ASIZE
+
+/* Patterns up to this long take the suffix table on the stack */
+#define BM_SUFF_STACK	256
+
+/* ASCII case folding, one load per text byte instead of tolower() */
+const uint8_t ts_bm_fold[TS_BM_ASIZE] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27, 0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+	0x60, 0x61, 0x62, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x6b, 0x6c, 0x6d, 0x6e, 0x6f,
+	0x70, 0x71, 0x72, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff,
+};
+
+#ifdef TS_BM_STATS
+/* Counters of bm in this thread, named after the pattern */
+static struct ts_bm_stats *bm_stats(const struct ts_bm *bm)
+{
+	struct ts_bm_stats *st = bm_stats_get(bm, NULL, bm->patlen);
+	const uint8_t *p = bm_pattern(bm);
+	size_t i, n;
+
+	if (likely(st->name[0]))
+		return st;
+	n = snprintf(st->name, sizeof(st->name), "%s\"",
+		     bm->flags & TS_IGNORECASE ? "-i " : "");
+	/* Room for an escape and the ..." of a long one */
+	for (i = 0; i < bm->patlen && n + 9 <= sizeof(st->name); i++)
+		n += snprintf(st->name + n, sizeof(st->name) - n,
+			      isprint(p[i]) && p[i] != '"' && p[i] != '\\' ?
+			      "%c" : "\\x%02x", p[i]);
+	snprintf(st->name + n, sizeof(st->name) - n, "%s\"",
+		 i < bm->patlen ? "..." : "");
+	return st;
+}
+#endif
+
+/* The first known bytes of the first window are known to match already */
+static inline uint8_t *__bm_find(const struct ts_bm *bm, const uint8_t *text,
+				 uint32_t text_len, int shift, uint32_t known)
+{
+	const uint8_t *pattern = bm_pattern(bm);
+	int icase = bm->flags & TS_IGNORECASE;
+	unsigned int i, n = bm->patlen - known;
+	int bs;
+#ifdef TS_BM_STATS
+	struct ts_bm_stats *st = bm_stats(bm);
+	int start = shift - (bm->patlen - 1);
+#endif
+
+	while (shift < text_len) {
+		TS_BM_STAT(st, windows, 1);
+		for (i = 0; i < n; i++)
+			if ((icase ?
+			     ts_bm_fold[text[shift - i]] : text[shift - i])
+			    != pattern[bm->patlen - 1 - i])
+				goto next;
+
+		/* London calling... */
+		TS_BM_STAT(st, compares, n);
+		TS_BM_STAT(st, verified, 1);
+		return TS_BM_STAT_RET(st, start, shift + 1,
+			(uint8_t *)text + (shift- (bm->patlen - 1)));
+
+next:
+		TS_BM_STAT(st, compares, i + 1);
+		TS_BM_STAT(st, verified, i > 0);
+		n = bm->patlen;
+		bs = bm->bad_shift[text[shift - i]];
+
+		/* Now jumping to... */
+		bs = max_t(int, bs - i, bm->good_shift[i]);
+		TS_BM_STAT_SHIFT(st, bs);
+		shift += bs;
+	}
+
+	return TS_BM_STAT_RET(st, start, text_len, NULL);
+}
+
+/* q-gram ending at p, folded with TS_IGNORECASE as the pattern */
+static inline uint32_t bm_qgram_text(const struct ts_bm *bm,
+				     const uint8_t *p)
+{
+	const uint8_t *fold = ts_bm_fold;
+	uint32_t g;
+
+	if (bm->flags & TS_IGNORECASE) {
+		g = fold[p[-1]] << 8 | fold[p[0]];
+		if (bm->q == 3)
+			g |= fold[p[-2]] << 16;
+	} else {
+		g = p[-1] << 8 | p[0];
+		if (bm->q == 3)
+			g |= p[-2] << 16;
+	}
+	return TS_BM_QHASH(g);
+}
+
+static inline int bm_eq(const struct ts_bm *bm, const uint8_t *text)
+{
+	const uint8_t *pattern = bm_pattern(bm);
+	uint32_t i;
+
+	if (!(bm->flags & TS_IGNORECASE))
+		return memcmp(text, pattern, bm->patlen) == 0;
+	for (i = 0; i < bm->patlen; i++)
+		if (ts_bm_fold[text[i]] != pattern[i])
+			return 0;
+	return 1;
+}
+
+static uint8_t *__bm_find_q(const struct ts_bm *bm, const uint8_t *text,
+			    uint32_t text_len, uint32_t shift)
+{
+	const uint16_t *qshift = bm_qshift(bm);
+	uint32_t m = bm->patlen, sh;
+	uint64_t work = 0;
+#ifdef TS_BM_STATS
+	struct ts_bm_stats *st = bm_stats(bm);
+	int64_t start = shift - (m - 1);
+#endif
+
+	while (shift < text_len) {
+		TS_BM_STAT(st, windows, 1);
+		sh = qshift[bm_qgram_text(bm, text + shift)];
+		if (sh) {
+			TS_BM_STAT_SHIFT(st, sh);
+			shift += sh;
+			continue;
+		}
+		/* Too many candidates, BM from here on */
+		work += m;
+		if (work > 2 * (uint64_t)shift + 64 * m) {
+			TS_BM_STAT(st, bytes, shift - (m - 1) - start);
+			return __bm_find(bm, text, text_len, shift, 0);
+		}
+		TS_BM_STAT(st, verified, 1);
+		TS_BM_STAT(st, compares, m);
+		if (bm_eq(bm, text + shift - (m - 1)))
+			return TS_BM_STAT_RET(st, start, shift + 1,
+				(uint8_t *)text + shift - (m - 1));
+		TS_BM_STAT_SHIFT(st, bm->qmatch_shift);
+		shift += bm->qmatch_shift;
+	}
+	return TS_BM_STAT_RET(st, start, text_len, NULL);
+}
+
+/* The q-gram shifts know nothing of the bytes already matched */
+static inline uint8_t *__bm_scan(const struct ts_bm *bm, const uint8_t *text,
+				 uint32_t text_len, int shift, uint32_t known)
+{
+	if (bm->q && known == 0)
+		return __bm_find_q(bm, text, text_len, shift);
+	return __bm_find(bm, text, text_len, shift, known);
+}
+
+uint8_t *bm_find(const struct ts_bm *bm, const uint8_t *text,
+		 uint32_t text_len)
+{
+	return __bm_scan(bm, text, text_len, bm->patlen - 1, 0);
+}
+
+static inline int bm_next_shift(const struct ts_bm *bm, const uint8_t *text,
+				const uint8_t *match, int flags)
+{
+	return match - text + bm->patlen - 1 +
+		(flags & BM_OVERLAP ? bm->match_shift : bm->patlen);
+}
+
+/* Bytes of the window after a match that are still the matched ones */
+static inline uint32_t bm_next_known(const struct ts_bm *bm, int flags)
+{
+	return flags & BM_OVERLAP ? bm->patlen - bm->match_shift : 0;
+}
+
+/*
+ * Calls match() with the offset of every occurrence of the pattern, a
+ * non-zero return from match() stops the search. The search is resumed
+ * with the shift of the last match, it doesn't restart from scratch.
+ * Returns the number of matches.
+ */
+uint32_t bm_find_all(const struct ts_bm *bm, const uint8_t *text,
+		     uint32_t text_len, int flags,
+		     int (*match)(uint32_t off, void *arg), void *arg)
+{
+	uint32_t nr = 0, known = 0;
+	int shift = bm->patlen - 1;
+	uint8_t *p;
+
+	while ((p = __bm_scan(bm, text, text_len, shift, known))) {
+		nr++;
+		if (match && match(p - text, arg))
+			break;
+		shift = bm_next_shift(bm, text, p, flags);
+		known = bm_next_known(bm, flags);
+	}
+	return nr;
+}
+
+uint32_t bm_count(const struct ts_bm *bm, const uint8_t *text,
+		  uint32_t text_len, int flags)
+{
+	return bm_find_all(bm, text, text_len, flags, NULL, NULL);
+}
+
+/* Stores up to max match offsets into offs, returns how many were stored */
+uint32_t bm_find_offs(const struct ts_bm *bm, const uint8_t *text,
+		      uint32_t text_len, int flags, uint32_t *offs,
+		      uint32_t max)
+{
+	uint32_t nr = 0, known = 0;
+	int shift = bm->patlen - 1;
+	uint8_t *p;
+
+	while (nr < max &&
+	       (p = __bm_scan(bm, text, text_len, shift, known))) {
+		offs[nr++] = p - text;
+		shift = bm_next_shift(bm, text, p, flags);
+		known = bm_next_known(bm, flags);
+	}
+	return nr;
+}
+
+/*
+ * Streaming search over a text that comes in chunks (TCP segments, ring
+ * buffer slots...). Only the last patlen - 1 bytes of the stream are kept
+ * between calls, the chunks themselves are searched in place.
+ */
+struct ts_bm_stream *bm_stream_init(const struct ts_bm *bm)
+{
+	struct ts_bm_stream *ctx;
+
+	ctx = calloc(1, sizeof(*ctx) + 2 * (bm->patlen - 1));
+	if (ctx)
+		ctx->bm = bm;
+	return ctx;
+}
+
+void bm_stream_free(struct ts_bm_stream *ctx)
+{
+	free(ctx);
+}
+
+/*
+ * Returns the stream offset of the first match ending inside chunk, -1 if
+ * there is none. The chunk is consumed either way.
+ */
+int64_t bm_find_stream(struct ts_bm_stream *ctx, const uint8_t *chunk,
+		       uint32_t len)
+{
+	uint32_t keep = ctx->bm->patlen - 1, n = ctx->held;
+	int64_t ret = -1;
+	uint8_t *p;
+
+	/* Matches across the boundary start in the held bytes */
+	if (n) {
+		n += len < keep ? len : keep;
+		memcpy(ctx->buf + ctx->held, chunk, n - ctx->held);
+		p = bm_find(ctx->bm, ctx->buf, n);
+		if (p && p - ctx->buf < ctx->held)
+			ret = ctx->offset - ctx->held + (p - ctx->buf);
+	}
+	if (ret < 0) {
+		p = bm_find(ctx->bm, chunk, len);
+		if (p)
+			ret = ctx->offset + (p - chunk);
+	}
+
+	if (len >= keep) {
+		memcpy(ctx->buf, chunk + len - keep, keep);
+		ctx->held = keep;
+	} else {
+		if (ctx->held == 0) {
+			memcpy(ctx->buf, chunk, len);
+			n = len;
+		}
+		if (n > keep) {
+			memmove(ctx->buf, ctx->buf + n - keep, keep);
+			n = keep;
+		}
+		ctx->held = n;
+	}
+	ctx->offset += len;
+	return ret;
+}
+
+/*
+ * suff[i] is the length of the longest substring ending at i which is
+ * also a suffix of the pattern. Linear: a substring already compared
+ * (between g and f) is not compared again [2].
+ */
+static void compute_suffixes(const uint8_t *x, int m, int *suff)
+{
+	int f = m - 1, g = m - 1, i;
+
+	suff[m - 1] = m;
+	for (i = m - 2; i >= 0; i--) {
+		if (i > g && suff[i + m - 1 - f] < i - g) {
+			suff[i] = suff[i + m - 1 - f];
+		} else {
+			if (i < g)
+				g = i;
+			f = i;
+			while (g >= 0 && x[g] == x[g + m - 1 - f])
+				g--;
+			suff[i] = f - g;
+		}
+	}
+}
+
+/* suff is patlen entries of scratch */
+static void compute_prefix_tbl(struct ts_bm *bm, const uint8_t *pattern,
+			       int *suff)
+{
+	int m = bm->patlen, i, j;
+
+	for (i = 0; i < ASIZE; i++)
+		bm->bad_shift[i] = bm->patlen;
+	/* Both cases of a letter shift alike with TS_IGNORECASE */
+	for (i = 0; i < bm->patlen - 1; i++) {
+		bm->bad_shift[pattern[i]] = bm->patlen - 1 - i;
+		if (bm->flags & TS_IGNORECASE) {
+			bm->bad_shift[tolower(pattern[i])]
+			    = bm->patlen - 1 - i;
+			bm->bad_shift[toupper(pattern[i])]
+			    = bm->patlen - 1 - i;
+		}
+	}
+
+	/*
+	 * Compute the good shift array, used to match reocurrences of a
+	 * subpattern: good_shift[g] after g bytes matched is bmGs[m - 1 - g]
+	 * of [2]. The suffix of a border of the pattern shifts to that
+	 * border, then a reoccurrence of the matched suffix behind another
+	 * byte than the mismatched one, the rightmost one, overrides it.
+	 */
+	compute_suffixes(pattern, m, suff);
+	for (i = 0; i < m; i++)
+		bm->good_shift[i] = m;
+	for (i = m - 1, j = 0; i >= 0; i--)
+		if (suff[i] == i + 1)
+			for (; j < m - 1 - i; j++)
+				if (bm->good_shift[m - 1 - j] == m)
+					bm->good_shift[m - 1 - j] = m - 1 - i;
+	for (i = 0; i <= m - 2; i++)
+		bm->good_shift[suff[i]] = m - 1 - i;
+
+	/*
+	 * Shift after a full match: the smallest period of the pattern,
+	 * m less its longest border
+	 */
+	for (i = m - 2; i >= 0; i--)
+		if (suff[i] == i + 1)
+			break;
+	bm->match_shift = m - 1 - i;
+}
+
+/*
+ * Shift per hashed q-gram ending the window, 0 for the last one of the
+ * pattern, whose own shift goes to match_shift. Capped at 0xffff, shorter
+ * shifts are still safe. The generated hashq kernel uses it as well.
+ */
+void bm_qgram_shift(const uint8_t *pattern, uint32_t len, uint32_t q,
+		    uint16_t *shift, uint32_t *match_shift)
+{
+	uint32_t i, k, g, dflt = min_t(uint32_t, len - q + 1, 0xffff);
+
+	for (i = 0; i < TS_BM_QSIZE; i++)
+		shift[i] = dflt;
+	for (k = q - 1; k < len; k++) {
+		for (g = 0, i = k + 1 - q; i <= k; i++)
+			g = g << 8 | pattern[i];
+		g = TS_BM_QHASH(g);
+		if (k == len - 1) {
+			*match_shift = shift[g];
+			shift[g] = 0;
+		} else
+			shift[g] = min_t(uint32_t, len - 1 - k, 0xffff);
+	}
+}
+
+/* Rounded up, so the objects packed after this one stay aligned */
+size_t bm_size(uint32_t len)
+{
+	size_t size = ALIGN(sizeof(struct ts_bm) + len * sizeof(uint32_t) +
+			    len, sizeof(uint32_t));
+
+	if (bm_qgram(len))
+		size += TS_BM_QSIZE * sizeof(uint16_t);
+	return size;
+}
+
+/*
+ * Compiles the pattern into buf, bm_size(len) bytes aligned on 4. With
+ * TS_IGNORECASE the pattern is folded here, the texts while searching.
+ * Linear in len. NULL with errno set on failure, buf is left as it is.
+ */
+struct ts_bm *bm_init_buf(void *buf, const void *pattern, uint32_t len,
+			  int flags)
+{
+	int stack[BM_SUFF_STACK], *suff = stack;
+	struct ts_bm *bm = buf;
+	uint8_t *pat;
+	uint32_t i;
+
+	if (len == 0 || len > INT32_MAX / 8) {
+		errno = EINVAL;
+		return NULL;
+	}
+	if (len > BM_SUFF_STACK) {
+		suff = malloc(len * sizeof(*suff));
+		if (suff == NULL)
+			return NULL;
+	}
+	memset(bm, 0, bm_size(len));
+	bm->patlen = len;
+	bm->flags = flags;
+	bm->size = bm_size(len);
+	pat = (uint8_t *)bm_pattern(bm);
+	memcpy(pat, pattern, len);
+	if (flags & TS_IGNORECASE)
+		for (i = 0; i < len; i++)
+			pat[i] = ts_bm_fold[pat[i]];
+	compute_prefix_tbl(bm, pat, suff);
+	if (suff != stack)
+		free(suff);
+	bm->q = bm_qgram(len);
+	if (bm->q)
+		bm_qgram_shift(pat, len, bm->q, (uint16_t *)bm_qshift(bm),
+			       &bm->qmatch_shift);
+	return bm;
+}
+
+/* NULL with errno set on failure */
+struct ts_bm *bm_init(const void *pattern, uint32_t len, int flags)
+{
+	struct ts_bm *bm;
+
+	if (len == 0 || len > INT32_MAX / 8) {
+		errno = EINVAL;
+		return NULL;
+	}
+	bm = malloc(bm_size(len));
+	if (bm == NULL)
+		return NULL;
+	return bm_init_buf(bm, pattern, len, flags);
+}
+
+void bm_free(struct ts_bm *bm)
+{
+	free(bm);
+}
+
+/*
+ * Escape sequence after a '\': \a \b \f \n \r \t \v, \xHH, or any other
+ * punctuation char for itself. Returns the number of chars used from src,
+ * 0 if it is not a valid one.
+ */
+int bm_parse_escape(const char *src, uint8_t *dst)
+{
+	int err;
+
+	switch (*src) {
+	case 'a':
+		*dst = 0x07;
+		break;
+	case 'b':
+		*dst = 0x08;
+		break;
+	case 'f':
+		*dst = 0x0C;
+		break;
+	case 'n':
+		*dst = 0x0A;
+		break;
+	case 'r':
+		*dst = 0x0D;
+		break;
+	case 't':
+		*dst = 0x09;
+		break;
+	case 'v':
+		*dst = 0x0B;
+		break;
+	case 'x':
+		*dst = __hextou8((char *)(src + 1), &err);
+		return err ? 0 : 3;
+	default:
+		if (!ispunct((uint8_t)*src))
+			return 0;
+		*dst = *src;
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Pattern string to bytes, with the escapes of bm_parse_escape(), up to
+ * the first non printable char. Folded with TS_IGNORECASE, escapes too.
+ * dst needs strlen(src) bytes, returns the pattern length, 0 on error.
+ */
+uint32_t bm_parse_pattern(const char *src, uint8_t *dst, int flags)
+{
+	uint32_t len = 0;
+	int n;
+
+	while (isprint((uint8_t)*src)) {
+		if (*src == '\\') {
+			n = bm_parse_escape(src + 1, dst);
+			if (n == 0)
+				return 0;
+			src += n;
+		} else
+			*dst = *src;
+		if (flags & TS_IGNORECASE)
+			*dst = ts_bm_fold[*dst];
+
+		src++;
+		dst++;
+		len++;
+	}
+	return len;
+}
+
+void bm_dump(const struct ts_bm *bm, FILE *f)
+{
+	int i;
+
+	fprintf(f, "%u-%.*s[%u]\n", bm->patlen, (int)bm->patlen,
+		bm_pattern(bm), bm->size);
+	fprintf(f, "Bad Shift:\n");
+	for (i = 0; i < ASIZE; i++) {
+		if ((i % 16) == 0)
+			fprintf(f, "\n");
+		fprintf(f, "%d ", bm->bad_shift[i]);
+	}
+	fprintf(f, "\n");
+	fprintf(f, "Good Shift:\n");
+	for (i = 0; i < bm->patlen; i++) {
+		if ((i % 16) == 0)
+			fprintf(f, "\n");
+		fprintf(f, "%d ", bm->good_shift[i]);
+	}
+	fprintf(f, "\n");
+	if (bm->q)
+		fprintf(f, "%u-gram Shift: %u after a candidate\n", bm->q,
+			bm->qmatch_shift);
+}
@@ -0,0 +1,120 @@
+/*
+ * lib/ts_bm_batch.c	Boyer-Moore compilation of pattern sets
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Compiles a whole signature set into one buffer packed as for
+ *   bm_init_buf(), spread over threads. The objects are laid out before
+ *   any thread starts, so every thread writes its own objects only, and
+ *   takes the next run of patterns from a shared index: a few long
+ *   patterns don't hold one thread while the others are done.
+ *
+ *   The buffer is only handed to the searching threads once complete,
+ *   so a set may be rebuilt aside and swapped in under traffic.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include "common.h"
+#include "ts_bm.h"
+
+/* Patterns taken at once by a thread */
+#define BM_BATCH_RUN	16
+
+struct bm_batch
+{
+	struct ts_bm_src *src;
+	uint32_t nr;
+	uint32_t next;		/* next pattern to take, atomic */
+	int err;		/* first errno, atomic */
+};
+
+static void *bm_batch_worker(void *arg)
+{
+	struct bm_batch *b = arg;
+	uint32_t i, end;
+
+	for (;;) {
+		i = __atomic_fetch_add(&b->next, BM_BATCH_RUN,
+				       __ATOMIC_RELAXED);
+		if (i >= b->nr)
+			break;
+		end = min_t(uint32_t, i + BM_BATCH_RUN, b->nr);
+		for (; i < end; i++) {
+			struct ts_bm_src *s = &b->src[i];
+
+			if (bm_init_buf(s->bm, s->pattern, s->len,
+					s->flags) == NULL) {
+				int err = 0;
+
+				__atomic_compare_exchange_n(&b->err, &err,
+					errno, 0, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED);
+			}
+		}
+	}
+	return NULL;
+}
+
+/* Bytes of buf for the nr patterns of src */
+size_t bm_batch_size(const struct ts_bm_src *src, uint32_t nr)
+{
+	size_t size = 0;
+	uint32_t i;
+
+	for (i = 0; i < nr; i++)
+		size += bm_size(src[i].len);
+	return size;
+}
+
+/*
+ * Compiles the nr patterns of src into buf, bm_batch_size() bytes aligned
+ * on 4, in order, and points src[i].bm at them. Up to threads threads,
+ * one per CPU if threads is 0. Returns 0, else -1 with errno set, the
+ * objects are then not all valid.
+ */
+int bm_init_batch(void *buf, struct ts_bm_src *src, uint32_t nr,
+		  int threads)
+{
+	struct bm_batch b = { .src = src, .nr = nr };
+	pthread_t *tids;
+	uint8_t *p = buf;
+	uint32_t i;
+	int t, n;
+
+	for (i = 0; i < nr; i++) {
+		if (src[i].len == 0 || src[i].len > INT32_MAX / 8) {
+			errno = EINVAL;
+			return -1;
+		}
+		src[i].bm = (struct ts_bm *)p;
+		p += bm_size(src[i].len);
+	}
+
+	if (threads <= 0)
+		threads = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = min_t(uint32_t, threads,
+			(nr + BM_BATCH_RUN - 1) / BM_BATCH_RUN);
+	tids = threads > 1 ? calloc(threads - 1, sizeof(*tids)) : NULL;
+	/* The calling thread is one of them */
+	for (n = 0; tids && n < threads - 1; n++)
+		if (pthread_create(&tids[n], NULL, bm_batch_worker, &b))
+			break;
+	bm_batch_worker(&b);
+	for (t = 0; t < n; t++)
+		pthread_join(tids[t], NULL);
+	free(tids);
+
+	if (b.err) {
+		errno = b.err;
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,204 @@
+/*
+ * lib/ts_bm_jit.c	Boyer-Moore x86-64 code generator
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Emits for a struct ts_bm the loop bm_build writes in C: the pattern
+ *   bytes are the immediates of an unrolled compare chain, and every
+ *   mismatch position i has its own exit, taking the good shift of i as
+ *   an immediate and the bad shift from a table copied after the code.
+ *
+ *	text: rdi, len: rsi, shift: rdx, bad shift table: r8
+ *
+ *		mov	esi, esi
+ *		mov	edx, m - 1
+ *		lea	r8, [rip + bad_shift]
+ *	loop:	cmp	rdx, rsi
+ *		jae	none
+ *		movzx	eax, byte [rdi + rdx - i]	; i = 0 .. m - 1
+ *		or	al, 0x20			; letters with -i
+ *		cmp	al, pattern[m - 1 - i]
+ *		jne	mismatch_i
+ *		...
+ *		lea	rax, [rdi + rdx - (m - 1)]
+ *		ret
+ *	none:	xor	eax, eax
+ *		ret
+ *	mismatch_i:
+ *		movzx	eax, byte [rdi + rdx - i]
+ *		mov	eax, [r8 + rax * 4]
+ *		sub	eax, i
+ *		mov	r9d, good_shift[i]
+ *		cmp	eax, r9d
+ *		cmovl	eax, r9d
+ *		add	rdx, rax
+ *		jmp	loop
+ *
+ *   With -i the pattern is lower case, and x | 0x20 equals a lower case
+ *   letter only when x is that letter in either case; the bad shift takes
+ *   the raw byte, its table has both cases.
+ *
+ *   The code is written to a private mapping, then made read-only and
+ *   executable: it is never writable and executable at once.
+ */
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include "common.h"
+#include "ts_bm_jit.h"
+
+struct jit_buf
+{
+	uint8_t *p;
+	size_t len;
+};
+
+static inline void emit(struct jit_buf *b, const void *ins, size_t len)
+{
+	if (b->p)
+		memcpy(b->p + b->len, ins, len);
+	b->len += len;
+}
+
+static inline void emit_u8(struct jit_buf *b, uint8_t v)
+{
+	emit(b, &v, 1);
+}
+
+/* x86 only, so little endian */
+static inline void emit_u32(struct jit_buf *b, uint32_t v)
+{
+	emit(b, &v, 4);
+}
+
+/* movzx eax, byte [rdi + rdx + disp] */
+static void emit_load(struct jit_buf *b, int32_t disp)
+{
+	if (disp >= -128) {
+		emit(b, "\x0f\xb6\x44\x17", 4);
+		emit_u8(b, disp);
+	} else {
+		emit(b, "\x0f\xb6\x84\x17", 4);
+		emit_u32(b, disp);
+	}
+}
+
+/* rel32 of a jump ending at b->len + 4 towards target */
+static inline void emit_rel(struct jit_buf *b, size_t target)
+{
+	emit_u32(b, target - (b->len + 4));
+}
+
+/* Code offsets, every jump being rel32 they don't depend on the targets */
+struct jit_layout
+{
+	size_t none;
+	size_t tbl;
+	size_t exits[TS_BM_JIT_MAX];
+};
+
+/*
+ * Two passes: the first one with a NULL buffer only sizes the code and
+ * fills the layout, the second one writes it.
+ */
+static size_t jit_emit(const struct ts_bm *bm, uint8_t *code,
+		       struct jit_layout *l)
+{
+	const uint8_t *pattern = bm_pattern(bm);
+	struct jit_buf b = { .p = code };
+	uint32_t m = bm->patlen, i;
+	size_t loop;
+	uint8_t c;
+
+	emit(&b, "\x89\xf6", 2);			/* mov esi, esi */
+	emit_u8(&b, 0xba);				/* mov edx, m - 1 */
+	emit_u32(&b, m - 1);
+	emit(&b, "\x4c\x8d\x05", 3);			/* lea r8, [rip + d] */
+	emit_rel(&b, l->tbl);
+
+	loop = b.len;
+	emit(&b, "\x48\x39\xf2", 3);			/* cmp rdx, rsi */
+	emit(&b, "\x0f\x83", 2);			/* jae none */
+	emit_rel(&b, l->none);
+	for (i = 0; i < m; i++) {
+		c = pattern[m - 1 - i];
+		emit_load(&b, -(int32_t)i);
+		if ((bm->flags & TS_IGNORECASE) && c >= 'a' && c <= 'z')
+			emit(&b, "\x0c\x20", 2);	/* or al, 0x20 */
+		emit_u8(&b, 0x3c);			/* cmp al, c */
+		emit_u8(&b, c);
+		emit(&b, "\x0f\x85", 2);		/* jne mismatch_i */
+		emit_rel(&b, l->exits[i]);
+	}
+	emit(&b, "\x48\x8d\x84\x17", 4);		/* lea rax, [...] */
+	emit_u32(&b, -(int32_t)(m - 1));
+	emit_u8(&b, 0xc3);				/* ret */
+
+	l->none = b.len;
+	emit(&b, "\x31\xc0\xc3", 3);			/* xor eax, eax; ret */
+
+	for (i = 0; i < m; i++) {
+		l->exits[i] = b.len;
+		emit_load(&b, -(int32_t)i);
+		emit(&b, "\x41\x8b\x04\x80", 4);	/* mov eax, [r8+rax*4] */
+		if (i) {
+			emit_u8(&b, 0x2d);		/* sub eax, i */
+			emit_u32(&b, i);
+		}
+		emit(&b, "\x41\xb9", 2);		/* mov r9d, gs */
+		emit_u32(&b, bm->good_shift[i]);
+		emit(&b, "\x44\x39\xc8", 3);		/* cmp eax, r9d */
+		emit(&b, "\x41\x0f\x4c\xc1", 4);	/* cmovl eax, r9d */
+		emit(&b, "\x48\x01\xc2", 3);		/* add rdx, rax */
+		emit_u8(&b, 0xe9);			/* jmp loop */
+		emit_rel(&b, loop);
+	}
+
+	l->tbl = ALIGN(b.len, 64);
+	if (code)
+		memcpy(code + l->tbl, bm->bad_shift, sizeof(bm->bad_shift));
+	return l->tbl + sizeof(bm->bad_shift);
+}
+
+/* NULL with errno set on failure, else find is NULL if it can't JIT */
+struct ts_bm_jit *bm_jit(const struct ts_bm *bm)
+{
+	struct ts_bm_jit *jit;
+	struct jit_layout l = { 0 };
+	uint8_t *code;
+
+	jit = calloc(1, sizeof(*jit));
+	if (jit == NULL)
+		return NULL;
+	jit->bm = bm;
+#if defined(__x86_64__)
+	if (bm->patlen > TS_BM_JIT_MAX)
+		return jit;
+
+	jit->size = jit_emit(bm, NULL, &l);
+	code = mmap(NULL, jit->size, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (code == MAP_FAILED)
+		return jit;
+	jit_emit(bm, code, &l);
+	if (mprotect(code, jit->size, PROT_READ | PROT_EXEC) < 0) {
+		munmap(code, jit->size);
+		return jit;
+	}
+	jit->code = code;
+	jit->find = (bm_jit_fn)code;
+#endif
+	return jit;
+}
+
+void bm_jit_free(struct ts_bm_jit *jit)
+{
+	if (jit && jit->code)
+		munmap(jit->code, jit->size);
+	free(jit);
+}
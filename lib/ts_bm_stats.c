@@ -0,0 +1,215 @@
+/*
+ * lib/ts_bm_stats.c	Boyer-Moore search counters
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Only built with -DTS_BM_STATS. Every thread has its own open addressed
+ *   table of counters, keyed by the struct ts_bm or the generated pattern,
+ *   so the kernels count without atomics or locks. The tables are linked
+ *   once on a global list, and kept after their thread is gone, so that
+ *   bm_stats_dump() still sums them up.
+ *
+ *   The dump reads counters other threads may be writing: the figures are
+ *   exact once the searches are over, close enough while they run. A
+ *   struct ts_bm freed and another allocated at the same address share
+ *   their counters, the name is the one of the first.
+ */
+
+#include <stdlib.h>
+#include "common.h"
+#include "ts_bm.h"
+
+#ifdef TS_BM_STATS
+#include <pthread.h>
+
+#define BM_STATS_BITS	10
+#define BM_STATS_SLOTS	(1 << BM_STATS_BITS)
+
+struct bm_stats_tbl
+{
+	struct bm_stats_tbl *next;
+	struct ts_bm_stats other;	/* once all the slots are taken */
+	struct ts_bm_stats slot[BM_STATS_SLOTS];
+};
+
+static __thread struct bm_stats_tbl *bm_stats_local;
+/* Out of memory, not dumped */
+static __thread struct ts_bm_stats bm_stats_lost = { .name = "(lost)" };
+
+static struct bm_stats_tbl *bm_stats_list;
+static pthread_mutex_t bm_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static struct bm_stats_tbl *bm_stats_tbl(void)
+{
+	struct bm_stats_tbl *t;
+
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	strcpy(t->other.name, "(other)");
+	pthread_mutex_lock(&bm_stats_lock);
+	t->next = bm_stats_list;
+	bm_stats_list = t;
+	pthread_mutex_unlock(&bm_stats_lock);
+	bm_stats_local = t;
+	return t;
+}
+
+/*
+ * Counters of key in this thread, name and patlen are only used the
+ * first time. With a NULL name it is left empty for the caller.
+ */
+struct ts_bm_stats *bm_stats_get(const void *key, const char *name,
+				 uint32_t patlen)
+{
+	struct bm_stats_tbl *t = bm_stats_local;
+	struct ts_bm_stats *st;
+	uint32_t h, n;
+
+	if (unlikely(t == NULL)) {
+		t = bm_stats_tbl();
+		if (t == NULL)
+			return &bm_stats_lost;
+	}
+	h = ((uintptr_t)key * 0x9E3779B97F4A7C15ULL) >> (64 - BM_STATS_BITS);
+	for (n = 0; n < BM_STATS_SLOTS; n++) {
+		st = &t->slot[(h + n) & (BM_STATS_SLOTS - 1)];
+		if (likely(st->key == key))
+			return st;
+		if (st->key == NULL) {
+			st->key = key;
+			st->patlen = patlen;
+			if (name)
+				snprintf(st->name, sizeof(st->name), "%s",
+					 name);
+			return st;
+		}
+	}
+	return &t->other;
+}
+
+static void bm_stats_clear(struct ts_bm_stats *st)
+{
+	memset(&st->bytes, 0, sizeof(*st) - offsetof(struct ts_bm_stats,
+						     bytes));
+}
+
+/* Counters of all the threads back to 0, the patterns stay */
+void bm_stats_reset(void)
+{
+	struct bm_stats_tbl *t;
+	uint32_t i;
+
+	pthread_mutex_lock(&bm_stats_lock);
+	for (t = bm_stats_list; t; t = t->next) {
+		for (i = 0; i < BM_STATS_SLOTS; i++)
+			bm_stats_clear(&t->slot[i]);
+		bm_stats_clear(&t->other);
+	}
+	pthread_mutex_unlock(&bm_stats_lock);
+}
+
+static void bm_stats_add(struct ts_bm_stats *a, const struct ts_bm_stats *b)
+{
+	a->bytes += b->bytes;
+	a->windows += b->windows;
+	a->compares += b->compares;
+	a->shifts += b->shifts;
+	a->shift_sum += b->shift_sum;
+	a->shift_max = max_t(uint64_t, a->shift_max, b->shift_max);
+	a->verified += b->verified;
+	a->matches += b->matches;
+}
+
+/* Windows and compares per byte of text */
+static double bm_stats_cost(const struct ts_bm_stats *st)
+{
+	return st->bytes ? (double)(st->windows + st->compares) / st->bytes :
+			   0;
+}
+
+static int bm_stats_name_cmp(const void *a, const void *b)
+{
+	const struct ts_bm_stats *x = a, *y = b;
+	int ret = strcmp(x->name, y->name);
+
+	if (ret)
+		return ret;
+	return x->patlen < y->patlen ? -1 : x->patlen > y->patlen;
+}
+
+static int bm_stats_cost_cmp(const void *a, const void *b)
+{
+	double x = bm_stats_cost(a), y = bm_stats_cost(b);
+
+	return x < y ? 1 : x > y ? -1 : bm_stats_name_cmp(a, b);
+}
+
+/*
+ * One line per pattern, the counters of all the threads summed up,
+ * costliest first: cost is windows plus compares per byte of text, skip
+ * the average shift over the pattern length (1 is a shift of m on every
+ * window).
+ */
+void bm_stats_dump(FILE *f)
+{
+	struct ts_bm_stats *all, *st;
+	struct bm_stats_tbl *t;
+	uint32_t i, nr = 0, n;
+
+	pthread_mutex_lock(&bm_stats_lock);
+	for (t = bm_stats_list; t; t = t->next)
+		nr += BM_STATS_SLOTS + 1;
+	all = malloc((nr ? nr : 1) * sizeof(*all));
+	if (all == NULL) {
+		pthread_mutex_unlock(&bm_stats_lock);
+		fprintf(f, "bm_stats: Out of Memory.\n");
+		return;
+	}
+	nr = 0;
+	for (t = bm_stats_list; t; t = t->next) {
+		for (i = 0; i < BM_STATS_SLOTS; i++)
+			if (t->slot[i].key)
+				all[nr++] = t->slot[i];
+		if (t->other.windows)
+			all[nr++] = t->other;
+	}
+	pthread_mutex_unlock(&bm_stats_lock);
+
+	/* Same pattern from several threads or objects */
+	qsort(all, nr, sizeof(*all), bm_stats_name_cmp);
+	for (i = 0, n = 0; i < nr; i++) {
+		if (n && bm_stats_name_cmp(&all[n - 1], &all[i]) == 0)
+			bm_stats_add(&all[n - 1], &all[i]);
+		else
+			all[n++] = all[i];
+	}
+	qsort(all, n, sizeof(*all), bm_stats_cost_cmp);
+
+	fprintf(f, "%-32s %5s %14s %8s %8s %9s %9s %5s %12s %10s\n",
+		"pattern", "len", "bytes", "cost/B", "cmp/B", "avg_shift",
+		"max_shift", "skip", "candidates", "matches");
+	for (i = 0; i < n; i++) {
+		st = &all[i];
+		if (st->bytes == 0 && st->windows == 0)
+			continue;
+		fprintf(f, "%-32s %5u %14llu %8.3f %8.3f %9.2f %9llu %5.2f "
+			"%12llu %10llu\n", st->name, st->patlen,
+			(unsigned long long)st->bytes, bm_stats_cost(st),
+			st->bytes ? (double)st->compares / st->bytes : 0,
+			st->shifts ? (double)st->shift_sum / st->shifts : 0,
+			(unsigned long long)st->shift_max,
+			st->shifts && st->patlen ? (double)st->shift_sum /
+				st->shifts / st->patlen : 0,
+			(unsigned long long)st->verified,
+			(unsigned long long)st->matches);
+	}
+	free(all);
+}
+
+#endif	/* TS_BM_STATS */
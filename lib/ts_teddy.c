@@ -0,0 +1,304 @@
+/*
+ * lib/ts_teddy.c	Teddy multi-literal search
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   The literal matcher of Hyperscan, for up to 32 short patterns, where
+ *   one bm_find() per pattern rescans the text each time and Aho-Corasick
+ *   walks a byte at a time.
+ *
+ *   Patterns are spread over 8 buckets, one bit each. For the first
+ *   nmask bytes of the patterns, two 16 entry tables give per low and high
+ *   nibble value the buckets having a byte with that nibble there. pshufb
+ *   looks both nibbles of 16 (32 with AVX2) text bytes up at once:
+ *
+ *	c[k] = lo[k][text[i + k] & 0xf] & hi[k][text[i + k] >> 4]
+ *
+ *   and c[0] & c[1] & ... is, per position i, the buckets of which a
+ *   pattern may start there. The few positions left are verified
+ *   against the patterns of their buckets.
+ *
+ *   Sorted patterns go to buckets in runs, so patterns sharing a prefix
+ *   share a bucket and the buckets keep their masks sparse.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include "common.h"
+#include "ts_teddy.h"
+
+/* Longest pattern string, every byte written as \xHH */
+#define TEDDY_SRCLEN	(4 * TS_TEDDY_MAXLEN)
+
+/* Insertion sort of pattern ids, by pattern bytes or else by id */
+static void teddy_sort(const struct ts_teddy *t, uint8_t *ids, uint32_t nr,
+		       int bytes)
+{
+	uint32_t i, j;
+	uint8_t id;
+
+	for (i = 1; i < nr; i++) {
+		id = ids[i];
+		for (j = i; j > 0; j--) {
+			if (bytes ? memcmp(t->pattern[ids[j - 1]],
+					   t->pattern[id],
+					   TS_TEDDY_MAXLEN) <= 0 :
+				    ids[j - 1] < id)
+				break;
+			ids[j] = ids[j - 1];
+		}
+		ids[j] = id;
+	}
+}
+
+static void teddy_mask(struct ts_teddy *t, int k, uint8_t c, uint8_t bit)
+{
+	t->lo[k][c & 0xf] |= bit;
+	t->hi[k][c >> 4] |= bit;
+}
+
+/* NULL with errno EINVAL if a pattern is empty, too long or bad */
+struct ts_teddy *teddy_init(const char *const *patterns, uint32_t nr,
+			    int flags)
+{
+	uint8_t buf[TEDDY_SRCLEN], order[TS_TEDDY_MAX];
+	uint32_t i, b, k, len, per, minlen = TS_TEDDY_MAXLEN;
+	struct ts_teddy *t;
+
+	if (nr == 0 || nr > TS_TEDDY_MAX) {
+		errno = EINVAL;
+		return NULL;
+	}
+	t = calloc(1, sizeof(*t));
+	if (t == NULL)
+		return NULL;
+	t->nr = nr;
+	t->flags = flags;
+
+	for (i = 0; i < nr; i++) {
+		len = 0;
+		if (strlen(patterns[i]) <= TEDDY_SRCLEN)
+			len = bm_parse_pattern(patterns[i], buf, flags);
+		if (len == 0 || len > TS_TEDDY_MAXLEN) {
+			free(t);
+			errno = EINVAL;
+			return NULL;
+		}
+		memcpy(t->pattern[i], buf, len);
+		t->len[i] = len;
+		minlen = min_t(uint32_t, minlen, len);
+		order[i] = i;
+	}
+	t->nmask = min_t(uint32_t, minlen, TS_TEDDY_MASKS);
+
+	teddy_sort(t, order, nr, 1);
+
+	per = (nr + TS_TEDDY_BUCKETS - 1) / TS_TEDDY_BUCKETS;
+	for (i = 0; i < nr; i++) {
+		b = i / per;
+		t->bucket[b][t->bucket_nr[b]++] = order[i];
+		for (k = 0; k < t->nmask; k++) {
+			uint8_t c = t->pattern[order[i]][k];
+
+			teddy_mask(t, k, c, 1 << b);
+			if ((flags & TS_IGNORECASE) && c >= 'a' && c <= 'z')
+				teddy_mask(t, k, c - ('a' - 'A'), 1 << b);
+		}
+	}
+	for (b = 0; b < TS_TEDDY_BUCKETS; b++)
+		teddy_sort(t, t->bucket[b], t->bucket_nr[b], 0);
+	return t;
+}
+
+void teddy_free(struct ts_teddy *t)
+{
+	free(t);
+}
+
+static inline int teddy_eq(const struct ts_teddy *t, const uint8_t *text,
+			   uint32_t id)
+{
+	const uint8_t *pattern = t->pattern[id];
+	uint32_t i;
+
+	if (!(t->flags & TS_IGNORECASE))
+		return memcmp(text, pattern, t->len[id]) == 0;
+	for (i = 0; i < t->len[id]; i++)
+		if (ts_bm_fold[text[i]] != pattern[i])
+			return 0;
+	return 1;
+}
+
+/* Lowest pattern id of the buckets in bits matching at pos, -1 if none */
+static int teddy_verify(const struct ts_teddy *t, const uint8_t *text,
+			uint32_t len, uint32_t pos, uint32_t bits)
+{
+	uint32_t b, j, id;
+	int best = -1;
+
+	while (bits) {
+		b = __builtin_ctz(bits);
+		bits &= bits - 1;
+		for (j = 0; j < t->bucket_nr[b]; j++) {
+			id = t->bucket[b][j];
+			if (best >= 0 && id > (uint32_t)best)
+				break;
+			if (t->len[id] <= len - pos &&
+			    teddy_eq(t, text + pos, id)) {
+				best = id;
+				break;
+			}
+		}
+	}
+	return best;
+}
+
+/* Buckets that may start at pos, the nmask bytes are in the text */
+static inline uint32_t teddy_filter(const struct ts_teddy *t,
+				    const uint8_t *text)
+{
+	uint32_t k, bits = 0xff;
+
+	for (k = 0; k < t->nmask; k++)
+		bits &= t->lo[k][text[k] & 0xf] & t->hi[k][text[k] >> 4];
+	return bits;
+}
+
+static uint8_t *teddy_find_scalar(const struct ts_teddy *t,
+				  const uint8_t *text, uint32_t len,
+				  uint32_t pos, uint32_t *id)
+{
+	uint32_t bits;
+	int best;
+
+	for (; pos + t->nmask <= len; pos++) {
+		bits = teddy_filter(t, text + pos);
+		if (bits == 0)
+			continue;
+		best = teddy_verify(t, text, len, pos, bits);
+		if (best >= 0) {
+			if (id)
+				*id = best;
+			return (uint8_t *)text + pos;
+		}
+	}
+	return NULL;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+
+__attribute__((target("ssse3")))
+static uint8_t *teddy_find_ssse3(const struct ts_teddy *t,
+				 const uint8_t *text, uint32_t len,
+				 uint32_t *id)
+{
+	const __m128i nib = _mm_set1_epi8(0x0f);
+	__m128i lo[TS_TEDDY_MASKS], hi[TS_TEDDY_MASKS], v, c;
+	uint32_t i, k, mask, bit;
+	uint8_t bits[16];
+	int best;
+
+	for (k = 0; k < t->nmask; k++) {
+		lo[k] = _mm_loadu_si128((const __m128i *)t->lo[k]);
+		hi[k] = _mm_loadu_si128((const __m128i *)t->hi[k]);
+	}
+	for (i = 0; i + 16 + t->nmask - 1 <= len; i += 16) {
+		c = _mm_set1_epi8((char)0xff);
+		for (k = 0; k < t->nmask; k++) {
+			v = _mm_loadu_si128((const __m128i *)(text + i +
+							       k));
+			c = _mm_and_si128(c, _mm_and_si128(
+				_mm_shuffle_epi8(lo[k],
+					_mm_and_si128(v, nib)),
+				_mm_shuffle_epi8(hi[k], _mm_and_si128(
+					_mm_srli_epi16(v, 4), nib))));
+		}
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(c,
+				_mm_setzero_si128())) & 0xffff;
+		if (mask)
+			_mm_storeu_si128((__m128i *)bits, c);
+		while (mask) {
+			bit = __builtin_ctz(mask);
+			mask &= mask - 1;
+			best = teddy_verify(t, text, len, i + bit,
+					    bits[bit]);
+			if (best >= 0) {
+				if (id)
+					*id = best;
+				return (uint8_t *)text + i + bit;
+			}
+		}
+	}
+	return teddy_find_scalar(t, text, len, i, id);
+}
+
+__attribute__((target("avx2")))
+static uint8_t *teddy_find_avx2(const struct ts_teddy *t,
+				const uint8_t *text, uint32_t len,
+				uint32_t *id)
+{
+	const __m256i nib = _mm256_set1_epi8(0x0f);
+	__m256i lo[TS_TEDDY_MASKS], hi[TS_TEDDY_MASKS], v, c;
+	uint32_t i, k, mask, bit;
+	uint8_t bits[32];
+	int best;
+
+	/* pshufb looks up per 128 bit lane, same tables in both */
+	for (k = 0; k < t->nmask; k++) {
+		lo[k] = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)t->lo[k]));
+		hi[k] = _mm256_broadcastsi128_si256(
+			_mm_loadu_si128((const __m128i *)t->hi[k]));
+	}
+	for (i = 0; i + 32 + t->nmask - 1 <= len; i += 32) {
+		c = _mm256_set1_epi8((char)0xff);
+		for (k = 0; k < t->nmask; k++) {
+			v = _mm256_loadu_si256((const __m256i *)(text + i +
+								 k));
+			c = _mm256_and_si256(c, _mm256_and_si256(
+				_mm256_shuffle_epi8(lo[k],
+					_mm256_and_si256(v, nib)),
+				_mm256_shuffle_epi8(hi[k], _mm256_and_si256(
+					_mm256_srli_epi16(v, 4), nib))));
+		}
+		mask = ~_mm256_movemask_epi8(_mm256_cmpeq_epi8(c,
+				_mm256_setzero_si256()));
+		if (mask)
+			_mm256_storeu_si256((__m256i *)bits, c);
+		while (mask) {
+			bit = __builtin_ctz(mask);
+			mask &= mask - 1;
+			best = teddy_verify(t, text, len, i + bit,
+					    bits[bit]);
+			if (best >= 0) {
+				if (id)
+					*id = best;
+				return (uint8_t *)text + i + bit;
+			}
+		}
+	}
+	return teddy_find_scalar(t, text, len, i, id);
+}
+#endif
+
+/*
+ * First match in text, its pattern id in *id when id isn't NULL. NULL if
+ * no pattern is found.
+ */
+uint8_t *teddy_find(const struct ts_teddy *t, const uint8_t *text,
+		    uint32_t len, uint32_t *id)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	if (__builtin_cpu_supports("avx2"))
+		return teddy_find_avx2(t, text, len, id);
+	if (__builtin_cpu_supports("ssse3"))
+		return teddy_find_ssse3(t, text, len, id);
+#endif
+	return teddy_find_scalar(t, text, len, 0, id);
+}
@@ -0,0 +1,535 @@
+/*
+ * pcap_class.c		Offline packet classifier on the Boyer-Moore matchers
+ *
+ *		This program is free software; you can redistribute it and/or
+ *		modify it under the terms of the GNU General Public License
+ *		as published by the Free Software Foundation; either version
+ *		2 of the License, or (at your option) any later version.
+ *
+ * ==========================================================================
+ *
+ *   Replays a capture (classic pcap, Ethernet with VLAN tags, Linux
+ *   cooked or raw IP) through a rule table, and reports the packets and
+ *   bytes of every class and the packets per second of the classifier.
+ *   The TCP and UDP payloads of IPv4 and IPv6 packets are searched, non
+ *   first fragments are not.
+ *
+ *   Rules are "class prio [-i ]pattern" lines, pattern as for bm_build,
+ *   "#" is a comment. The highest prio is tried first, then file order.
+ *   A packet goes to the first class which matches, or with -A to every
+ *   class which matches.
+ *
+ *   The rule file is compiled at once with bm_init_batch(), over -j
+ *   threads, and the compile time is reported with the rest.
+ *
+ *   Instead of a rule file, the rules may be compiled in with generated
+ *   matchers: -DPCAP_RULES='"rules.h"', a header including the outputs of
+ *   bm_build -n NAME and defining PCAP_RULE_LIST as a list of
+ *   PCAP_RULE(class, prio, NAME) entries.
+ *
+ *   Built with -DTS_BM_STATS and lib/ts_bm_stats.c, the report ends with
+ *   the search counters of every rule, costliest first.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <endian.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "common.h"
+#include "ts_bm.h"
+
+#ifdef PCAP_RULES
+#include PCAP_RULES
+#endif
+
+#define PCAP_MAGIC		0xa1b2c3d4
+#define PCAP_MAGIC_NSEC		0xa1b23c4d
+
+#define DLT_EN10MB		1
+#define DLT_RAW			101
+#define DLT_LINUX_SLL		113
+
+#define ETH_P_IP		0x0800
+#define ETH_P_IPV6		0x86dd
+#define ETH_P_8021Q		0x8100
+#define ETH_P_8021AD		0x88a8
+
+#define CLASS_MAX		256
+
+struct pcap_hdr
+{
+	uint32_t magic;
+	uint16_t version_major;
+	uint16_t version_minor;
+	int32_t thiszone;
+	uint32_t sigfigs;
+	uint32_t snaplen;
+	uint32_t linktype;
+};
+
+struct pcap_rec
+{
+	uint32_t ts_sec;
+	uint32_t ts_frac;
+	uint32_t caplen;
+	uint32_t len;
+};
+
+typedef uint8_t *(*pcap_find_t)(const uint8_t *text, uint32_t len);
+
+struct pcap_rule
+{
+	uint32_t class;
+	int prio;
+	int line;
+	const struct ts_bm *bm;	/* runtime matcher... */
+	pcap_find_t find;	/* ...or generated one */
+};
+
+struct pcap_class
+{
+	uint64_t packets;
+	uint64_t bytes;
+};
+
+static struct pcap_rule *rules;
+static uint32_t nr_rules;
+static struct pcap_class classes[CLASS_MAX];
+static struct pcap_class unmatched, skipped;
+static int all_match;
+/* Rule file compilation */
+static int nr_threads;
+static uint64_t load_ns, load_bytes;
+
+static inline uint32_t pcap_u32(uint32_t v, int swapped)
+{
+	return swapped ? swap32(v) : v;
+}
+
+/*
+ * L4 payload of an IP packet, NULL if there is none to search (not TCP
+ * or UDP, non first fragment, truncated).
+ */
+static const uint8_t *ip_payload(const uint8_t *p, uint32_t len,
+				 uint32_t *plen)
+{
+	uint32_t hlen, tot;
+	uint8_t proto, ext;
+
+	if (len < 1)
+		return NULL;
+	switch (p[0] >> 4) {
+	case 4:
+		if (len < 20)
+			return NULL;
+		hlen = (p[0] & 0xf) * 4;
+		tot = load_n16(p + 2);
+		if (load_n16(p + 6) & 0x1fff)
+			return NULL;
+		proto = p[9];
+		break;
+	case 6:
+		if (len < 40)
+			return NULL;
+		hlen = 40;
+		tot = 40 + load_n16(p + 4);
+		proto = p[6];
+		/* Hop by hop, routing, fragment and destination options */
+		while (proto == 0 || proto == 43 || proto == 44 ||
+		       proto == 60) {
+			if (len < hlen + 8)
+				return NULL;
+			ext = proto;
+			if (ext == 44 && (load_n16(p + hlen + 2) & 0xfff8))
+				return NULL;
+			proto = p[hlen];
+			hlen += ext == 44 ? 8 : (p[hlen + 1] + 1) * 8;
+		}
+		break;
+	default:
+		return NULL;
+	}
+	if (tot < len)
+		len = tot;
+
+	switch (proto) {
+	case 6:		/* TCP */
+		if (len < hlen + 20)
+			return NULL;
+		hlen += (p[hlen + 12] >> 4) * 4;
+		break;
+	case 17:	/* UDP */
+		hlen += 8;
+		break;
+	default:
+		return NULL;
+	}
+	if (len <= hlen)
+		return NULL;
+	*plen = len - hlen;
+	return p + hlen;
+}
+
+static const uint8_t *pcap_payload(uint32_t linktype, const uint8_t *p,
+				   uint32_t len, uint32_t *plen)
+{
+	uint32_t off;
+	uint16_t type;
+
+	switch (linktype) {
+	case DLT_EN10MB:
+		/* Skip the VLAN tags */
+		for (off = 12; ; off += 4) {
+			if (len < off + 2)
+				return NULL;
+			type = load_n16(p + off);
+			if (type != ETH_P_8021Q && type != ETH_P_8021AD)
+				break;
+		}
+		off += 2;
+		break;
+	case DLT_LINUX_SLL:
+		if (len < 16)
+			return NULL;
+		type = load_n16(p + 14);
+		off = 16;
+		break;
+	case DLT_RAW:
+		return ip_payload(p, len, plen);
+	default:
+		return NULL;
+	}
+	if (type != ETH_P_IP && type != ETH_P_IPV6)
+		return NULL;
+	return ip_payload(p + off, len - off, plen);
+}
+
+static inline int rule_match(const struct pcap_rule *r, const uint8_t *p,
+			     uint32_t len)
+{
+	if (r->find)
+		return r->find(p, len) != NULL;
+	return bm_find(r->bm, p, len) != NULL;
+}
+
+static void classify(const uint8_t *p, uint32_t len, uint32_t wire)
+{
+	uint8_t seen[CLASS_MAX];
+	uint32_t i, nr = 0;
+
+	if (all_match)
+		memset(seen, 0, sizeof(seen));
+	for (i = 0; i < nr_rules; i++) {
+		if (!rule_match(&rules[i], p, len))
+			continue;
+		if (all_match) {
+			if (seen[rules[i].class])
+				continue;
+			seen[rules[i].class] = 1;
+		}
+		classes[rules[i].class].packets++;
+		classes[rules[i].class].bytes += wire;
+		nr++;
+		if (!all_match)
+			break;
+	}
+	if (nr == 0) {
+		unmatched.packets++;
+		unmatched.bytes += wire;
+	}
+}
+
+/* Returns the number of packets, -1 on a malformed capture */
+static int64_t pcap_replay(const uint8_t *data, size_t size)
+{
+	const struct pcap_hdr *hdr = (const struct pcap_hdr *)data;
+	const struct pcap_rec *rec;
+	const uint8_t *payload;
+	uint32_t linktype, caplen, plen;
+	size_t off = sizeof(*hdr);
+	int64_t nr = 0;
+	int swapped;
+
+	if (size < sizeof(*hdr))
+		return -1;
+	if (hdr->magic == PCAP_MAGIC || hdr->magic == PCAP_MAGIC_NSEC)
+		swapped = 0;
+	else if (hdr->magic == swap32(PCAP_MAGIC) ||
+		 hdr->magic == swap32(PCAP_MAGIC_NSEC))
+		swapped = 1;
+	else
+		return -1;
+	linktype = pcap_u32(hdr->linktype, swapped);
+
+	while (off + sizeof(*rec) <= size) {
+		rec = (const struct pcap_rec *)(data + off);
+		caplen = pcap_u32(rec->caplen, swapped);
+		off += sizeof(*rec);
+		if (caplen > size - off)
+			return -1;
+		payload = pcap_payload(linktype, data + off, caplen, &plen);
+		if (payload)
+			classify(payload, plen, pcap_u32(rec->len, swapped));
+		else {
+			skipped.packets++;
+			skipped.bytes += pcap_u32(rec->len, swapped);
+		}
+		off += caplen;
+		nr++;
+	}
+	return nr;
+}
+
+static int rule_cmp(const void *a, const void *b)
+{
+	const struct pcap_rule *x = a, *y = b;
+
+	if (x->prio != y->prio)
+		return x->prio < y->prio ? 1 : -1;
+	return x->line - y->line;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * The compiled patterns are packed in one buffer, in rule order, compiled
+ * by nr_threads threads
+ */
+static int rules_load(const char *file)
+{
+	struct { char *pat; int flags; } *src = NULL;
+	struct ts_bm_src *bms;
+	char *line = NULL, *s;
+	uint8_t *pat, *p, *buf;
+	uint32_t class, i, len;
+	size_t size = 0, total = 0;
+	int lineno = 0, prio, n;
+	uint64_t ns;
+	FILE *fp;
+
+	fp = fopen(file, "r");
+	if (fp == NULL) {
+		perror(file);
+		return -1;
+	}
+	while (getline(&line, &size, fp) != -1) {
+		lineno++;
+		if (line[0] == '#' || line[0] == '\n')
+			continue;
+		if (sscanf(line, "%u %d %n", &class, &prio, &n) != 2 ||
+		    class >= CLASS_MAX) {
+			fprintf(stderr, "%s:%d: Rule Error.\n", file, lineno);
+			return -1;
+		}
+		rules = realloc(rules, (nr_rules + 1) * sizeof(*rules));
+		src = realloc(src, (nr_rules + 1) * sizeof(*src));
+		if (rules == NULL || src == NULL) {
+			fprintf(stderr, "Out of Memory.\n");
+			return -1;
+		}
+		s = line + n;
+		src[nr_rules].flags = 0;
+		if (strncmp(s, "-i ", 3) == 0) {
+			src[nr_rules].flags = TS_IGNORECASE;
+			s += 3;
+		}
+		src[nr_rules].pat = strdup(s);
+		rules[nr_rules] = (struct pcap_rule) {
+			.class = class, .prio = prio, .line = lineno,
+		};
+		nr_rules++;
+	}
+	free(line);
+	fclose(fp);
+
+	/* The patterns can only shrink when parsed */
+	for (i = 0; i < nr_rules; i++)
+		total += strlen(src[i].pat);
+	pat = malloc(total + 1);
+	bms = calloc(nr_rules + 1, sizeof(*bms));
+	if (pat == NULL || bms == NULL) {
+		fprintf(stderr, "Out of Memory.\n");
+		return -1;
+	}
+	for (i = 0, p = pat; i < nr_rules; i++) {
+		len = bm_parse_pattern(src[i].pat, p, src[i].flags);
+		if (len == 0) {
+			fprintf(stderr, "%s:%d: Pattern Error.\n", file,
+				rules[i].line);
+			return -1;
+		}
+		bms[i] = (struct ts_bm_src) {
+			.pattern = p, .len = len, .flags = src[i].flags,
+		};
+		p += len;
+		load_bytes += len;
+		free(src[i].pat);
+	}
+	free(src);
+
+	ns = now_ns();
+	buf = malloc(bm_batch_size(bms, nr_rules));
+	if (buf == NULL || bm_init_batch(buf, bms, nr_rules, nr_threads)) {
+		perror(file);
+		return -1;
+	}
+	load_ns = now_ns() - ns;
+	for (i = 0; i < nr_rules; i++)
+		rules[i].bm = bms[i].bm;
+	free(bms);
+	free(pat);
+	qsort(rules, nr_rules, sizeof(*rules), rule_cmp);
+	return 0;
+}
+
+#ifdef PCAP_RULE_LIST
+#define PCAP_RULE(c, p, name)	{ .class = c, .prio = p, .find = bm_find_##name },
+static struct pcap_rule gen_rules[] = { PCAP_RULE_LIST };
+#undef PCAP_RULE
+
+static int rules_gen(void)
+{
+	uint32_t i;
+
+	rules = gen_rules;
+	nr_rules = sizeof(gen_rules) / sizeof(gen_rules[0]);
+	for (i = 0; i < nr_rules; i++) {
+		if (rules[i].class >= CLASS_MAX)
+			return -1;
+		rules[i].line = i;
+	}
+	qsort(rules, nr_rules, sizeof(*rules), rule_cmp);
+	return 0;
+}
+#endif
+
+static void usage(void)
+{
+#ifdef PCAP_RULE_LIST
+	fprintf(stderr, "Usage: pcap_class [-A] [-j threads] [-l loops] "
+		"[-r Rule_File] Capture_File\n");
+	fprintf(stderr, "       -r  -- Rules instead of the compiled in ones\n");
+#else
+	fprintf(stderr, "Usage: pcap_class [-A] [-j threads] [-l loops] "
+		"-r Rule_File Capture_File\n");
+	fprintf(stderr, "       -r  -- \"class prio [-i ]pattern\" lines\n");
+#endif
+	fprintf(stderr, "       -A  -- Count a packet in every class matching, "
+		"not the first one\n");
+	fprintf(stderr, "       -j  -- Threads compiling the rule file, one "
+		"per CPU by default\n");
+	fprintf(stderr, "       -l  -- Replay the capture loops times\n");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *rule_file = NULL;
+	int opt, fd, loops = 1, l, i;
+	int64_t nr = 0, n;
+	uint64_t ns;
+	struct stat st;
+	uint8_t *data;
+
+	while ((opt = getopt(argc, argv, "Aj:l:r:")) != -1) {
+		switch (opt) {
+		case 'A':
+			all_match = 1;
+			break;
+		case 'j':
+			nr_threads = atoi(optarg);
+			break;
+		case 'l':
+			loops = atoi(optarg);
+			break;
+		case 'r':
+			rule_file = optarg;
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (optind != argc - 1 || loops < 1) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+	if (rule_file) {
+		if (rules_load(rule_file))
+			exit(EXIT_FAILURE);
+	} else {
+#ifdef PCAP_RULE_LIST
+		if (rules_gen()) {
+			fprintf(stderr, "Rule Error.\n");
+			exit(EXIT_FAILURE);
+		}
+#else
+		usage();
+		exit(EXIT_FAILURE);
+#endif
+	}
+
+	fd = open(argv[optind], O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror(argv[optind]);
+		exit(EXIT_FAILURE);
+	}
+	madvise(data, st.st_size, MADV_WILLNEED);
+
+	ns = now_ns();
+	for (l = 0; l < loops; l++) {
+		n = pcap_replay(data, st.st_size);
+		if (n < 0) {
+			fprintf(stderr, "%s: Not a pcap file or truncated.\n",
+				argv[optind]);
+			exit(EXIT_FAILURE);
+		}
+		nr += n;
+	}
+	ns = now_ns() - ns;
+
+	printf("%-10s %14s %18s\n", "class", "packets", "bytes");
+	for (i = 0; i < CLASS_MAX; i++)
+		if (classes[i].packets)
+			printf("%-10d %14llu %18llu\n", i,
+			       (unsigned long long)classes[i].packets,
+			       (unsigned long long)classes[i].bytes);
+	printf("%-10s %14llu %18llu\n", "unmatched",
+	       (unsigned long long)unmatched.packets,
+	       (unsigned long long)unmatched.bytes);
+	printf("%-10s %14llu %18llu\n", "no payload",
+	       (unsigned long long)skipped.packets,
+	       (unsigned long long)skipped.bytes);
+	printf("\n%lld packets, %u rules, %.3f ms: %.0f pps, %.1f ns/packet\n",
+	       (long long)nr, nr_rules, ns / 1e6,
+	       ns ? nr * 1e9 / ns : 0, nr ? (double)ns / nr : 0);
+	if (rule_file)
+		printf("%.1f KB of patterns compiled in %.3f ms: %.2f us/KB\n",
+		       load_bytes / 1024.0, load_ns / 1e6,
+		       load_bytes ? load_ns / 1e3 / (load_bytes / 1024.0) : 0);
+#ifdef TS_BM_STATS
+	printf("\n");
+	bm_stats_dump(stdout);
+#endif
+	munmap(data, st.st_size);
+	close(fd);
+	return EXIT_SUCCESS;
+}